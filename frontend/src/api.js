@@ -35,6 +35,21 @@ export const api = {
     }
   },
 
+  getHistory: async (channel, from, to, step) => {
+    const params = new URLSearchParams({ channel });
+    if (from !== undefined) params.append('from', from);
+    if (to !== undefined) params.append('to', to);
+    if (step !== undefined) params.append('step', step);
+    try {
+      const res = await fetch(`${API_BASE}/history?${params}`);
+      if (!res.ok) throw new Error('Network response was not ok');
+      return await res.json();
+    } catch (e) {
+      console.error("Error fetching history:", e);
+      return null;
+    }
+  },
+
   getLogs: async () => {
     try {
       const res = await fetch(`${API_BASE}/logs`);
@@ -61,10 +76,15 @@ export const api = {
         },
         body: params
       });
-      return res.ok;
+      if (!res.ok) {
+        // Validation failures carry a reason; auth failures do not
+        const body = await res.json().catch(() => ({}));
+        return body.error ? { error: body.error } : null;
+      }
+      return await res.json();
     } catch (e) {
       console.error("Error saving config:", e);
-      return false;
+      return null;
     }
   }
 };
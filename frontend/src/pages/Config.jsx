@@ -1,6 +1,15 @@
 import { useEffect, useState } from 'preact/hooks';
 import { api } from '../api';
 
+const SENSOR_TYPES = [
+  'dht11', 'dht22', 'ds18b20', 'bme280', 'bmp280', 'sht31',
+  'lm35', 'tmp36', 'mq2', 'mq135', 'ldr', 'soil_moisture', 'water_level', 'ph_sensor', 'tds_meter',
+  'ccs811', 'scd40', 'bh1750', 'tsl2561', 'vl53l0x',
+  'pir', 'relay'
+];
+const I2C_TYPES = ['bme280', 'bmp280', 'sht31', 'ccs811', 'scd40', 'bh1750', 'tsl2561', 'vl53l0x'];
+const NEW_SENSOR = { type: 'none', pin: 0, i2cAddress: 0x76, i2cMultiplexerChannel: -1, tempOffset: 0, humOffset: 0, resolution: 12 };
+
 export function Config() {
   const [config, setConfig] = useState(null);
   const [loading, setLoading] = useState(true);
@@ -13,9 +22,7 @@ export function Config() {
   useEffect(() => {
     api.getCurrentConfig().then(data => {
       if (data) {
-          if (!data.sensors) {
-              data.sensors = Array(4).fill({ type: 0, pin: 0, i2cAddress: 0x76, i2cMultiplexerChannel: -1 });
-          }
+          if (!data.sensors) data.sensors = [];
           setConfig(data);
       }
       setLoading(false);
@@ -63,12 +70,20 @@ export function Config() {
       setConfig(prev => {
           const newSensors = [...prev.sensors];
           let val = value;
-          if (field === 'pin' || field === 'type' || field === 'i2cMultiplexerChannel') val = parseInt(value);
+          if (field === 'pin' || field === 'i2cMultiplexerChannel' || field === 'resolution') val = parseInt(value);
           newSensors[index] = { ...newSensors[index], [field]: val };
           return { ...prev, sensors: newSensors };
       });
   };
   
+  const addSensor = () => {
+      setConfig(prev => ({ ...prev, sensors: [...prev.sensors, { ...NEW_SENSOR }] }));
+  };
+
+  const removeSensor = (index) => {
+      setConfig(prev => ({ ...prev, sensors: prev.sensors.filter((_, i) => i !== index) }));
+  };
+
   const handleCheckboxChange = (e) => {
       const { name, checked } = e.target;
       setConfig(prev => ({
@@ -82,6 +97,9 @@ export function Config() {
     setSaving(true);
     
     const submission = { ...config };
+    delete submission.sensors;
+    delete submission.maxSensors;
+    submission.sensorCount = config.sensors.length;
     config.sensors.forEach((s, i) => {
         submission[`sensorType${i}`] = s.type;
         submission[`sensorPin${i}`] = s.pin;
@@ -89,14 +107,20 @@ export function Config() {
         submission[`sensorMux${i}`] = s.i2cMultiplexerChannel;
         submission[`sensorTOff${i}`] = s.tempOffset;
         submission[`sensorHOff${i}`] = s.humOffset;
+        submission[`sensorRes${i}`] = s.resolution;
     });
 
     submission.testingMode = config.testingMode ? "on" : "off";
     submission.mqttEnabled = config.mqttEnabled ? "on" : "off";
+    submission.staticIp = config.staticIp ? "on" : "off";
+    submission.dutyCycle = config.dutyCycle ? "on" : "off";
+    submission.adaptiveSampling = config.adaptiveSampling ? "on" : "off";
 
-    const success = await api.saveConfig(submission);
-    if (success) {
-      alert("Configuration saved! Device is restarting...");
+    const result = await api.saveConfig(submission);
+    if (result && result.error) {
+      alert(`Configuration not saved: ${result.error}`);
+    } else if (result) {
+      alert(result.restart ? "Configuration saved! Device is restarting..." : "Configuration applied.");
     } else {
       alert("Failed to save configuration. Check credentials.");
     }
@@ -133,6 +157,30 @@ export function Config() {
                         <input type="password" class="form-control" name="password" value={config.password} onInput={handleChange} />
                     </div>
                 </div>
+                <div class="form-check mb-3">
+                    <input class="form-check-input" type="checkbox" name="staticIp" checked={config.staticIp} onChange={handleCheckboxChange} />
+                    <label class="form-check-label">Static IP (skips DHCP, faster reconnects)</label>
+                </div>
+                {config.staticIp && (
+                    <div class="row">
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">IP Address</label>
+                            <input type="text" class="form-control" name="staticAddress" value={config.staticAddress} onInput={handleChange} placeholder="192.168.1.50" />
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Gateway</label>
+                            <input type="text" class="form-control" name="staticGateway" value={config.staticGateway} onInput={handleChange} />
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Subnet Mask</label>
+                            <input type="text" class="form-control" name="staticSubnet" value={config.staticSubnet} onInput={handleChange} />
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">DNS</label>
+                            <input type="text" class="form-control" name="staticDns" value={config.staticDns} onInput={handleChange} />
+                        </div>
+                    </div>
+                )}
                 <div class="mb-3">
                     <label class="form-label">Remote API Endpoint</label>
                     <input type="text" class="form-control" name="apiEndpoint" value={config.apiEndpoint} onInput={handleChange} placeholder="https://api.example.com" />
@@ -174,6 +222,8 @@ export function Config() {
                                 <th>Mux Ch</th>
                                 <th>T-Off (&deg;C)</th>
                                 <th>H-Off (%)</th>
+                                <th>Res</th>
+                                <th></th>
                             </tr>
                         </thead>
                         <tbody>
@@ -182,10 +232,8 @@ export function Config() {
                                     <td>{i+1}</td>
                                     <td>
                                         <select class="form-select form-select-sm" value={sensor.type} onChange={(e) => handleSensorChange(i, 'type', e.target.value)}>
-                                            <option value="0">Disabled</option>
-                                            <option value="11">DHT11</option>
-                                            <option value="22">DHT22</option>
-                                            <option value="2">BME280</option>
+                                            <option value="none">Disabled</option>
+                                            {SENSOR_TYPES.map(t => <option value={t}>{t.toUpperCase()}</option>)}
                                         </select>
                                     </td>
                                     <td>
@@ -193,15 +241,15 @@ export function Config() {
                                     </td>
                                     <td>
                                         <input type="text" class="form-control form-control-sm" value={sensor.i2cAddress} 
-                                               disabled={sensor.type != 2}
+                                               disabled={!I2C_TYPES.includes(sensor.type)}
                                                onInput={(e) => handleSensorChange(i, 'i2cAddress', e.target.value)} placeholder="0x76" />
                                     </td>
                                     <td>
                                         <select class="form-select form-select-sm" value={sensor.i2cMultiplexerChannel} 
-                                                disabled={sensor.type != 2}
+                                                disabled={!I2C_TYPES.includes(sensor.type)}
                                                 onChange={(e) => handleSensorChange(i, 'i2cMultiplexerChannel', e.target.value)}>
                                             <option value="-1">None</option>
-                                            {[...Array(8)].map((_, i) => <option value={i}>Ch {i}</option>)}
+                                            {[...Array(64)].map((_, i) => <option value={i}>0x{(0x70 + (i >> 3)).toString(16)} Ch {i & 7}</option>)}
                                         </select>
                                     </td>
                                     <td>
@@ -210,11 +258,39 @@ export function Config() {
                                     <td>
                                         <input type="number" step="0.1" class="form-control form-control-sm" value={sensor.humOffset} onInput={(e) => handleSensorChange(i, 'humOffset', e.target.value)} />
                                     </td>
+                                    <td>
+                                        <select class="form-select form-select-sm" value={sensor.resolution}
+                                                disabled={sensor.type !== 'ds18b20'}
+                                                onChange={(e) => handleSensorChange(i, 'resolution', e.target.value)}>
+                                            {[9, 10, 11, 12].map(b => <option value={b}>{b}-bit</option>)}
+                                        </select>
+                                    </td>
+                                    <td>
+                                        <button type="button" class="btn btn-sm btn-outline-danger" onClick={() => removeSensor(i)}>&times;</button>
+                                    </td>
                                 </tr>
                             ))}
                         </tbody>
                     </table>
                 </div>
+                <button type="button" class="btn btn-sm btn-outline-success" onClick={addSensor}
+                        disabled={config.maxSensors && config.sensors.length >= config.maxSensors}>
+                    Add Sensor
+                </button>
+                <div class="row mt-3">
+                    <div class="col-md-4">
+                        <label class="form-label">I2C Timeout (ms)</label>
+                        <input type="number" class="form-control form-control-sm" name="i2cTimeoutMs" value={config.i2cTimeoutMs} onInput={handleChange} min="1" max="1000" />
+                        <div class="form-text">Per transaction; a hung device is given up on after this.</div>
+                    </div>
+                    <div class="col-md-8">
+                        <div class="form-check mt-4">
+                            <input class="form-check-input" type="checkbox" name="adaptiveSampling" checked={config.adaptiveSampling} onChange={handleCheckboxChange} />
+                            <label class="form-check-label">Adaptive Sampling</label>
+                            <div class="form-text">Samples changing or noisy sensors faster (down to 1 s) and backs off on flat ones (up to 10 min), instead of once a minute.</div>
+                        </div>
+                    </div>
+                </div>
             </div>
         </div>
 
@@ -253,6 +329,16 @@ export function Config() {
                             <input type="text" class="form-control" name="firmwareUrl" value={config.firmwareUrl} onInput={handleChange} placeholder="http://domain.com/firmware.bin" />
                             <div class="form-text">URL for remote OTA updates via MQTT.</div>
                         </div>
+                        <div class="mb-3">
+                            <label class="form-label">Log Storage Budget (bytes)</label>
+                            <input type="number" class="form-control" name="logBudget" value={config.logBudget} onInput={handleChange} step="8192" min="16384" />
+                            <div class="form-text">Oldest 8 KB log segments are dropped beyond this size.</div>
+                        </div>
+                        <div class="mb-3">
+                            <label class="form-label">Log Levels</label>
+                            <input type="text" class="form-control" name="logLevels" value={config.logLevels} onInput={handleChange} placeholder="*=info,mqtt=debug" />
+                            <div class="form-text">Modules: system, config, wifi, mqtt, web, sensor, ota.</div>
+                        </div>
                         <div class="form-check">
                             <input class="form-check-input" type="checkbox" name="testingMode" checked={config.testingMode} onChange={handleCheckboxChange} />
                             <label class="form-check-label text-danger fw-bold">Simulation Mode</label>
@@ -292,8 +378,57 @@ export function Config() {
             </div>
         </div>
 
+        <div class="card shadow-sm mb-4">
+            <div class="card-header bg-warning text-dark">Power</div>
+            <div class="card-body">
+                <div class="form-check mb-3">
+                    <input class="form-check-input" type="checkbox" name="dutyCycle" checked={config.dutyCycle} onChange={handleCheckboxChange} />
+                    <label class="form-check-label">Deep-Sleep Duty Cycle</label>
+                    <div class="form-text">Samples between deep sleeps and uploads in batches. The web UI is only reachable while the setup button is held at wake. ESP8266 needs GPIO16 wired to RST.</div>
+                </div>
+                {config.dutyCycle && (
+                    <div class="row">
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Sleep (seconds)</label>
+                            <input type="number" class="form-control" name="sleepSeconds" value={config.sleepSeconds} onInput={handleChange} min="10" max="86400" />
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Upload Every (wakes)</label>
+                            <input type="number" class="form-control" name="uploadEveryWakes" value={config.uploadEveryWakes} onInput={handleChange} min="1" max="255" />
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Upload Threshold</label>
+                            <input type="number" class="form-control" name="uploadThreshold" value={config.uploadThreshold} onInput={handleChange} min="0" step="0.1" />
+                            <div class="form-text">Change that uploads early, 0 disables.</div>
+                        </div>
+                        <div class="col-md-3 mb-3">
+                            <label class="form-label">Setup Button Pin</label>
+                            <input type="number" class="form-control" name="setupButtonPin" value={config.setupButtonPin} onInput={handleChange} min="0" max="39" required />
+                            <div class="form-text">Active low. Required: hold it at wake to get back into setup.</div>
+                        </div>
+                    </div>
+                )}
+                <div class="row">
+                    <div class="col-md-6 mb-3">
+                        <label class="form-label">WiFi Sleep</label>
+                        <select class="form-select" name="wifiSleep" value={config.wifiSleep} onChange={handleChange}>
+                            <option value="0">None</option>
+                            <option value="1">Modem sleep</option>
+                            <option value="2">Light sleep</option>
+                        </select>
+                        <div class="form-text">Between tasks while always on. Light sleep on ESP32 needs a build with power management enabled.</div>
+                    </div>
+                    <div class="col-md-6 mb-3">
+                        <label class="form-label">Listen Interval (beacons)</label>
+                        <input type="number" class="form-control" name="listenInterval" value={config.listenInterval} onInput={handleChange} min="1" max="10" />
+                        <div class="form-text">Higher saves more power; adds up to ~100 ms per beacon to web and MQTT latency. Changing it briefly reconnects WiFi.</div>
+                    </div>
+                </div>
+            </div>
+        </div>
+
         <button type="submit" class="btn btn-primary btn-lg w-100 shadow py-3 fw-bold" disabled={saving}>
-            {saving ? 'RESTARTING DEVICE...' : 'APPLY CONFIGURATION'}
+            {saving ? 'APPLYING...' : 'APPLY CONFIGURATION'}
         </button>
       </form>
     </div>
@@ -58,13 +58,16 @@ export function Dashboard() {
                     <span class="h5 mb-0">{sensor.sensorType}</span>
                     <span class="badge bg-light text-dark ms-2 border">Pin {sensor.pin}</span>
                   </div>
-                  <span class={`badge ${sensor.valid ? 'bg-success' : 'bg-danger'}`}>
-                    {sensor.valid ? 'ONLINE' : 'OFFLINE'}
+                  <span class={`badge ${sensor.valid ? 'bg-success' : sensor.error === 'initializing' ? 'bg-warning text-dark' : 'bg-danger'}`}>
+                    {sensor.valid ? 'ONLINE' : sensor.error === 'initializing' ? 'STARTING' : 'OFFLINE'}
                   </span>
                 </div>
                 <div class="card-body">
-                  {!sensor.valid && sensor.error && (
-                      <div class="alert alert-danger py-2 mb-3 small">{sensor.error}</div>
+                  {!sensor.valid && sensor.error && sensor.error !== 'initializing' && (
+                      <div class="alert alert-danger py-2 mb-3 small">
+                        {sensor.error}
+                        {sensor.retryInMs !== undefined && ` (attempt ${sensor.initAttempts}, retrying in ${Math.ceil(sensor.retryInMs / 1000)} s)`}
+                      </div>
                   )}
                   
                   <div class="row">
@@ -8,6 +8,7 @@ struct Reading {
     String type;  // e.g. "Temperature", "Humidity", "Pressure"
     float value;
     String unit;  // e.g. "C", "%", "hPa"
+    String device; // Set when one driver reports several devices, e.g. a DS18B20 ROM id
 };
 
 struct SensorReadings {
@@ -16,12 +17,23 @@ struct SensorReadings {
     std::vector<Reading> readings;
     bool valid;
     String error;
+    uint64_t timestampMs = 0; // UTC epoch ms at read time, 0 while the clock is unset
+    uint32_t intervalMs = 0;  // Sampling interval the slot is running at
+    bool fresh = false;       // Read in the latest Sensor::update() pass; only these are sent
+};
+
+enum SensorInitStatus {
+    SENSOR_INIT_PENDING = 0, // Still starting up (warm-up, first measurement); call begin() again later
+    SENSOR_INIT_READY,
+    SENSOR_INIT_FAILED       // Device did not respond; the driver is re-created and retried later
 };
 
 class SensorInterface {
 public:
     virtual ~SensorInterface() {}
-    virtual void begin() = 0;
+    // Advances initialization by one step. Must not block waiting for warm-up;
+    // return SENSOR_INIT_PENDING instead and it will be called again.
+    virtual SensorInitStatus begin() = 0;
     virtual SensorReadings read() = 0;
 };
 
@@ -0,0 +1,33 @@
+#include "boot_profile.h"
+
+BootPhaseRecord BootProfile::_phases[BOOT_MAX_PHASES];
+uint8_t BootProfile::_count = 0;
+bool BootProfile::_reported = false;
+
+int BootProfile::begin(const char* name) {
+    if (_count >= BOOT_MAX_PHASES) return -1;
+    _phases[_count] = { name, (uint32_t)micros(), 0 };
+    return _count++;
+}
+
+void BootProfile::end(int phase) {
+    if (phase < 0 || phase >= _count) return;
+    _phases[phase].durationUs = micros() - _phases[phase].startUs;
+}
+
+void BootProfile::mark(const char* name) {
+    for (uint8_t i = 0; i < _count; i++) {
+        if (strcmp(_phases[i].name, name) == 0) return;
+    }
+    begin(name);
+}
+
+void BootProfile::toJson(JsonObject obj) {
+    JsonArray phases = obj["phases"].to<JsonArray>();
+    for (uint8_t i = 0; i < _count; i++) {
+        JsonObject p = phases.add<JsonObject>();
+        p["name"] = _phases[i].name;
+        p["startUs"] = _phases[i].startUs;
+        p["durationUs"] = _phases[i].durationUs;
+    }
+}
@@ -0,0 +1,42 @@
+#ifndef CALID_BOOT_PROFILE_H
+#define CALID_BOOT_PROFILE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define BOOT_MAX_PHASES 16
+
+struct BootPhaseRecord {
+    const char* name;    // Static string
+    uint32_t startUs;    // micros() at phase start
+    uint32_t durationUs; // 0 for milestones and phases still open
+};
+
+// Records boot phases with microsecond timestamps. Phases may overlap (WiFi
+// association runs alongside sensor init), so each one is opened and closed by index.
+class BootProfile {
+public:
+    static int begin(const char* name);
+    static void end(int phase);
+    static void mark(const char* name); // Zero-length milestone, recorded once
+
+    static void toJson(JsonObject obj);
+    static bool reported() { return _reported; }
+    static void setReported() { _reported = true; }
+
+private:
+    static BootPhaseRecord _phases[BOOT_MAX_PHASES];
+    static uint8_t _count;
+    static bool _reported;
+};
+
+// Times the enclosing scope as one boot phase
+class BootPhase {
+public:
+    explicit BootPhase(const char* name) : _phase(BootProfile::begin(name)) {}
+    ~BootPhase() { BootProfile::end(_phase); }
+private:
+    int _phase;
+};
+
+#endif
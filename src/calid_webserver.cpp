@@ -2,6 +2,19 @@
 #include "config.h"
 #include "sensor.h" 
 #include "logging.h"
+#include "config_reload.h"
+#include "history_store.h"
+#include "metrics.h"
+#include "boot_profile.h"
+#include "wifi_setup.h"
+#include "pipeline.h"
+#include "duty_cycle.h"
+#include "time_sync.h"
+#include "scheduler.h"
+#include "trace.h"
+#include "heap_monitor.h"
+#include "power_manager.h"
+#include "edge_capture.h"
 #include <LittleFS.h>
 #if defined(ESP8266)
 #include <Updater.h>
@@ -10,6 +23,7 @@
 #endif
 #include <ArduinoJson.h>
 #include <Wire.h>
+#include <memory>
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
 #include <ESP8266mDNS.h>
@@ -20,7 +34,7 @@
 
 const byte DNS_PORT = 53;
 
-CalidWebServer::CalidWebServer() : server(80) {}
+CalidWebServer::CalidWebServer() : server(80), _inflight(0), _reservedHeap(0) {}
 
 void CalidWebServer::begin() {
     if (WiFi.getMode() == WIFI_AP) {
@@ -31,7 +45,7 @@ void CalidWebServer::begin() {
     String dnsName = "calid-" + config.getAdoptionCode();
     dnsName.toLowerCase();
     if (MDNS.begin(dnsName.c_str())) {
-        Serial.printf("mDNS responder started: http://%s.local\n", dnsName.c_str());
+        LOGI(LOG_MOD_WEB, "mDNS responder started: http://%s.local", dnsName.c_str());
         MDNS.addService("http", "tcp", 80);
     }
 
@@ -61,13 +75,17 @@ void CalidWebServer::begin() {
     });
 
     // API Endpoints
-    server.on("/api/config", HTTP_POST, [this](AsyncWebServerRequest *request) { this->handleApiConfigSave(request); });
-    server.on("/api/config", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiConfigGet(request); });
-    server.on("/api/data", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiData(request); });
-    server.on("/api/logs", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiLogs(request); });
-    server.on("/api/system", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiSystem(request); });
-    server.on("/api/system/scan-i2c", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiScanI2C(request); });
-    server.on("/api/wifi/scan", HTTP_GET, [this](AsyncWebServerRequest *request) { this->handleApiWifiScan(request); });
+    server.on("/api/config", HTTP_POST, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_JSON)) this->handleApiConfigSave(request); });
+    server.on("/api/config", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_JSON)) this->handleApiConfigGet(request); });
+    server.on("/api/config/export", HTTP_POST, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiConfigExport(request); });
+    server.on("/api/data", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_JSON)) this->handleApiData(request); });
+    server.on("/api/logs", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiLogs(request); });
+    server.on("/api/system", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiSystem(request); });
+    server.on("/api/system/scan-i2c", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiScanI2C(request); });
+    server.on("/api/wifi/scan", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_LARGE)) this->handleApiWifiScan(request); });
+    server.on("/api/history", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiHistory(request); });
+    server.on("/metrics", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleMetrics(request); });
+    server.on("/api/trace", HTTP_GET, [this](AsyncWebServerRequest *request) { if (admit(request, WEB_BUDGET_SMALL)) this->handleApiTrace(request); });
 
     // Serve Static Files (Frontend)
     server.serveStatic("/", LittleFS, "/").setDefaultFile("index.html");
@@ -79,6 +97,8 @@ void CalidWebServer::begin() {
         response->addHeader("Connection", "close");
         request->send(response);
         if (shouldReboot) {
+            LOGI(LOG_MOD_OTA, "Firmware uploaded via web UI, rebooting");
+            logger.flush();
             delay(100);
             ESP.restart();
         }
@@ -107,11 +127,48 @@ bool CalidWebServer::authenticate(AsyncWebServerRequest *request) {
     return true;
 }
 
+// Reserves `budget` bytes for the lifetime of the request, or rejects it with 503
+bool CalidWebServer::admit(AsyncWebServerRequest *request, size_t budget) {
+    uint32_t freeHeap = ESP.getFreeHeap();
+    uint32_t reserved = _reservedHeap.load();
+    bool busy = _inflight.load() >= WEB_MAX_INFLIGHT;
+    bool lowHeap = freeHeap < WEB_HEAP_WATERMARK + reserved + budget;
+
+    if (busy || lowHeap) {
+        if (busy) metrics.webRejectedBusy++;
+        else metrics.webRejectedMemory++;
+        AsyncWebServerResponse *response = request->beginResponse(503, "application/json", "{\"error\":\"busy\"}");
+        response->addHeader("Retry-After", WEB_RETRY_AFTER_SECONDS);
+        request->send(response);
+        return false;
+    }
+
+    _inflight++;
+    _reservedHeap += budget;
+    metrics.webAdmitted++;
+    request->onDisconnect([this, budget]() {
+        _inflight--;
+        _reservedHeap -= budget;
+    });
+    return true;
+}
+
 void CalidWebServer::handleApiConfigSave(AsyncWebServerRequest *request) {
     if (!authenticate(request)) return;
 
+    std::unique_ptr<Config> previous = ConfigReload::snapshot();
+    if (!previous) {
+        request->send(503, "application/json", "{\"error\":\"busy\"}");
+        return;
+    }
+
     if (request->hasParam("ssid", true)) strlcpy(config.ssid, request->getParam("ssid", true)->value().c_str(), sizeof(config.ssid));
     if (request->hasParam("password", true)) strlcpy(config.password, request->getParam("password", true)->value().c_str(), sizeof(config.password));
+    config.staticIp = (request->hasParam("staticIp", true) && (request->getParam("staticIp", true)->value() == "on" || request->getParam("staticIp", true)->value() == "true"));
+    if (request->hasParam("staticAddress", true)) strlcpy(config.staticAddress, request->getParam("staticAddress", true)->value().c_str(), sizeof(config.staticAddress));
+    if (request->hasParam("staticGateway", true)) strlcpy(config.staticGateway, request->getParam("staticGateway", true)->value().c_str(), sizeof(config.staticGateway));
+    if (request->hasParam("staticSubnet", true)) strlcpy(config.staticSubnet, request->getParam("staticSubnet", true)->value().c_str(), sizeof(config.staticSubnet));
+    if (request->hasParam("staticDns", true)) strlcpy(config.staticDns, request->getParam("staticDns", true)->value().c_str(), sizeof(config.staticDns));
     if (request->hasParam("apiEndpoint", true)) strlcpy(config.apiEndpoint, request->getParam("apiEndpoint", true)->value().c_str(), sizeof(config.apiEndpoint));
     if (request->hasParam("sensorId", true)) strlcpy(config.sensorId, request->getParam("sensorId", true)->value().c_str(), sizeof(config.sensorId));
     if (request->hasParam("apiKey", true)) strlcpy(config.apiKey, request->getParam("apiKey", true)->value().c_str(), sizeof(config.apiKey));
@@ -126,33 +183,85 @@ void CalidWebServer::handleApiConfigSave(AsyncWebServerRequest *request) {
     if (request->hasParam("ntpServer", true)) strlcpy(config.ntpServer, request->getParam("ntpServer", true)->value().c_str(), sizeof(config.ntpServer));
     if (request->hasParam("firmwareUrl", true)) strlcpy(config.firmwareUrl, request->getParam("firmwareUrl", true)->value().c_str(), sizeof(config.firmwareUrl));
 
-    // Multi-sensor config
-    for (int i = 0; i < MAX_SENSORS; i++) {
+    // Multi-sensor config, only the slots the form declares
+    if (request->hasParam("sensorCount", true)) {
+        int count = request->getParam("sensorCount", true)->value().toInt();
+        config.sensorCount = constrain(count, 0, MAX_SENSORS);
+    }
+    for (int i = 0; i < config.sensorCount; i++) {
         String typeKey = "sensorType" + String(i);
         String pinKey = "sensorPin" + String(i);
         String i2cKey = "sensorI2C" + String(i);
         String muxKey = "sensorMux" + String(i);
         String tOffKey = "sensorTOff" + String(i);
         String hOffKey = "sensorHOff" + String(i);
+        String resKey = "sensorRes" + String(i);
         if (request->hasParam(typeKey, true)) strlcpy(config.sensors[i].type, request->getParam(typeKey, true)->value().c_str(), sizeof(config.sensors[i].type));
         if (request->hasParam(pinKey, true)) config.sensors[i].pin = request->getParam(pinKey, true)->value().toInt();
         if (request->hasParam(i2cKey, true)) config.sensors[i].i2cAddress = strtol(request->getParam(i2cKey, true)->value().c_str(), NULL, 0);
         if (request->hasParam(muxKey, true)) config.sensors[i].i2cMultiplexerChannel = request->getParam(muxKey, true)->value().toInt();
         if (request->hasParam(tOffKey, true)) config.sensors[i].tempOffset = request->getParam(tOffKey, true)->value().toFloat();
         if (request->hasParam(hOffKey, true)) config.sensors[i].humOffset = request->getParam(hOffKey, true)->value().toFloat();
+        if (request->hasParam(resKey, true)) config.sensors[i].resolution = constrain(request->getParam(resKey, true)->value().toInt(), 9, 12);
     }
 
+    if (request->hasParam("i2cTimeoutMs", true)) config.i2cTimeoutMs = constrain(request->getParam("i2cTimeoutMs", true)->value().toInt(), 1, 1000);
+    config.adaptiveSampling = (request->hasParam("adaptiveSampling", true) && (request->getParam("adaptiveSampling", true)->value() == "on" || request->getParam("adaptiveSampling", true)->value() == "true"));
+
     if(request->hasParam("mqttBroker", true)) strlcpy(config.mqttBroker, request->getParam("mqttBroker", true)->value().c_str(), sizeof(config.mqttBroker));
     if(request->hasParam("mqttPort", true)) config.mqttPort = request->getParam("mqttPort", true)->value().toInt();
     if(request->hasParam("mqttUser", true)) strlcpy(config.mqttUser, request->getParam("mqttUser", true)->value().c_str(), sizeof(config.mqttUser));
     if(request->hasParam("mqttPassword", true)) strlcpy(config.mqttPassword, request->getParam("mqttPassword", true)->value().c_str(), sizeof(config.mqttPassword));
     if(request->hasParam("mqttTopicPrefix", true)) strlcpy(config.mqttTopicPrefix, request->getParam("mqttTopicPrefix", true)->value().c_str(), sizeof(config.mqttTopicPrefix));
+    if(request->hasParam("logBudget", true)) config.logBudget = Logger::clampBudget(request->getParam("logBudget", true)->value().toInt());
+    if(request->hasParam("logLevels", true)) strlcpy(config.logLevels, request->getParam("logLevels", true)->value().c_str(), sizeof(config.logLevels));
     config.mqttEnabled = (request->hasParam("mqttEnabled", true) && (request->getParam("mqttEnabled", true)->value() == "on" || request->getParam("mqttEnabled", true)->value() == "true"));
+    config.dutyCycle = (request->hasParam("dutyCycle", true) && (request->getParam("dutyCycle", true)->value() == "on" || request->getParam("dutyCycle", true)->value() == "true"));
+    if (request->hasParam("sleepSeconds", true)) config.sleepSeconds = constrain(request->getParam("sleepSeconds", true)->value().toInt(), 10, 86400);
+    if (request->hasParam("uploadEveryWakes", true)) config.uploadEveryWakes = constrain(request->getParam("uploadEveryWakes", true)->value().toInt(), 1, 255);
+    if (request->hasParam("uploadThreshold", true)) config.uploadThreshold = max(0.0f, request->getParam("uploadThreshold", true)->value().toFloat());
+    if (request->hasParam("setupButtonPin", true)) config.setupButtonPin = constrain(request->getParam("setupButtonPin", true)->value().toInt(), -1, 39);
+    if (request->hasParam("wifiSleep", true)) config.wifiSleep = constrain(request->getParam("wifiSleep", true)->value().toInt(), POWER_SLEEP_NONE, POWER_SLEEP_LIGHT);
+    if (request->hasParam("listenInterval", true)) config.listenInterval = constrain(request->getParam("listenInterval", true)->value().toInt(), 1, POWER_MAX_LISTEN_INTERVAL);
+
+    // Duty-cycle wakes never serve the web UI or MQTT commands; the button is the only way back in
+    if (config.dutyCycle && config.setupButtonPin < 0) {
+        config = *previous;
+        request->send(400, "application/json", "{\"error\":\"Duty cycle needs a setup button pin to get back into setup\"}");
+        return;
+    }
+
+    // One ds18b20 slot reports every probe on its pin, at one resolution
+    for (int i = 0; i < config.sensorCount; i++) {
+        if (strcmp(config.sensors[i].type, "ds18b20") != 0) continue;
+        for (int j = 0; j < i; j++) {
+            if (strcmp(config.sensors[j].type, "ds18b20") == 0 && config.sensors[j].pin == config.sensors[i].pin) {
+                config = *previous;
+                request->send(400, "application/json", "{\"error\":\"Only one ds18b20 slot per pin; it reports every probe on that bus\"}");
+                return;
+            }
+        }
+    }
 
     config.save();
-    request->send(200, "application/json", "{\"success\":true, \"message\":\"Configuration saved. Restarting...\"}");
-    delay(1000);
-    ESP.restart();
+
+    ConfigDiff diff = ConfigReload::diff(*previous, config);
+    ConfigReload::schedule(diff);
+    if (diff.requiresRestart()) {
+        request->send(200, "application/json", "{\"success\":true, \"restart\":true, \"message\":\"Configuration saved. Restarting...\"}");
+    } else {
+        request->send(200, "application/json", "{\"success\":true, \"restart\":false, \"message\":\"Configuration applied.\"}");
+    }
+}
+
+// Writes config.json to flash, e.g. to copy it off the device
+void CalidWebServer::handleApiConfigExport(AsyncWebServerRequest *request) {
+    if (!authenticate(request)) return;
+    if (!config.exportJson()) {
+        request->send(500, "application/json", "{\"success\":false}");
+        return;
+    }
+    request->send(200, "application/json", "{\"success\":true}");
 }
 
 void CalidWebServer::handleApiConfigGet(AsyncWebServerRequest *request) {
@@ -161,6 +270,11 @@ void CalidWebServer::handleApiConfigGet(AsyncWebServerRequest *request) {
     JsonDocument doc;
     doc["ssid"] = config.ssid;
     doc["password"] = config.password;
+    doc["staticIp"] = config.staticIp;
+    doc["staticAddress"] = config.staticAddress;
+    doc["staticGateway"] = config.staticGateway;
+    doc["staticSubnet"] = config.staticSubnet;
+    doc["staticDns"] = config.staticDns;
     doc["apiEndpoint"] = config.apiEndpoint;
     doc["sensorId"] = config.sensorId;
     doc["apiKey"] = config.apiKey;
@@ -170,8 +284,9 @@ void CalidWebServer::handleApiConfigGet(AsyncWebServerRequest *request) {
     doc["ntpServer"] = config.ntpServer;
     doc["firmwareUrl"] = config.firmwareUrl;
 
+    doc["maxSensors"] = MAX_SENSORS;
     JsonArray sensorsArr = doc["sensors"].to<JsonArray>();
-    for (int i = 0; i < MAX_SENSORS; i++) {
+    for (int i = 0; i < config.sensorCount; i++) {
         JsonObject s = sensorsArr.add<JsonObject>();
         s["type"] = config.sensors[i].type;
         s["pin"] = config.sensors[i].pin;
@@ -179,13 +294,26 @@ void CalidWebServer::handleApiConfigGet(AsyncWebServerRequest *request) {
         s["i2cMultiplexerChannel"] = config.sensors[i].i2cMultiplexerChannel;
         s["tempOffset"] = config.sensors[i].tempOffset;
         s["humOffset"] = config.sensors[i].humOffset;
+        s["resolution"] = config.sensors[i].resolution;
     }
 
+    doc["i2cTimeoutMs"] = config.i2cTimeoutMs;
+    doc["adaptiveSampling"] = config.adaptiveSampling;
+
     doc["mqttBroker"] = config.mqttBroker;
     doc["mqttPort"] = config.mqttPort;
     doc["mqttUser"] = config.mqttUser;
     doc["mqttTopicPrefix"] = config.mqttTopicPrefix;
     doc["mqttEnabled"] = config.mqttEnabled;
+    doc["dutyCycle"] = config.dutyCycle;
+    doc["sleepSeconds"] = config.sleepSeconds;
+    doc["uploadEveryWakes"] = config.uploadEveryWakes;
+    doc["uploadThreshold"] = config.uploadThreshold;
+    doc["setupButtonPin"] = config.setupButtonPin;
+    doc["wifiSleep"] = config.wifiSleep;
+    doc["listenInterval"] = config.listenInterval;
+    doc["logBudget"] = config.logBudget;
+    doc["logLevels"] = config.logLevels;
 
     String json;
     serializeJson(doc, json);
@@ -193,21 +321,42 @@ void CalidWebServer::handleApiConfigGet(AsyncWebServerRequest *request) {
 }
 
 void CalidWebServer::handleApiData(AsyncWebServerRequest *request) {
+    SensorSnapshotRef snap = sensorSnapshot();
     JsonDocument doc;
+    doc["generation"] = snap->generation;
+    doc["ageMs"] = millis() - snap->takenAtMs;
+    doc["i2cBusRecoveries"] = metrics.i2cBusRecoveries.load();
     JsonArray sensorsArr = doc["sensors"].to<JsonArray>();
-    for (int i = 0; i < activeSensorCount; i++) {
+    for (size_t i = 0; i < snap->data.size(); i++) {
+        const SensorReadings& d = snap->data[i];
         JsonObject s = sensorsArr.add<JsonObject>();
-        s["pin"] = allSensorData[i].pin;
-        s["sensorType"] = allSensorData[i].sensorType;
-        s["valid"] = allSensorData[i].valid;
-        if (!allSensorData[i].valid) s["error"] = allSensorData[i].error;
+        s["pin"] = d.pin;
+        s["sensorType"] = d.sensorType;
+        s["valid"] = d.valid;
+        if (!d.valid) s["error"] = d.error;
+        if (d.timestampMs) s["timestamp"] = d.timestampMs;
+        if (d.intervalMs) s["intervalMs"] = d.intervalMs;
+        if (i < snap->init.size() && snap->init[i].state != SLOT_READY) {
+            const SlotInit& init = snap->init[i];
+            s["initAttempts"] = init.attempts;
+            int32_t retryIn = init.retryAt - millis();
+            if (init.state != SLOT_INITIALIZING) s["retryInMs"] = retryIn > 0 ? retryIn : 0;
+            if (init.state == SLOT_QUARANTINED) s["quarantined"] = true;
+        }
+        if (i < snap->health.size()) {
+            const SlotHealth& health = snap->health[i];
+            s["errors"] = health.errors;
+            s["consecutiveFailures"] = health.consecutiveFailures;
+            s["failingMs"] = health.totalFailingMs(millis());
+        }
         
         JsonArray readingsArr = s["readings"].to<JsonArray>();
-        for (const auto& r : allSensorData[i].readings) {
+        for (const auto& r : d.readings) {
             JsonObject ro = readingsArr.add<JsonObject>();
             ro["type"] = r.type;
             ro["value"] = r.value;
             ro["unit"] = r.unit;
+            if (r.device.length()) ro["device"] = r.device;
         }
     }
     String json;
@@ -217,11 +366,50 @@ void CalidWebServer::handleApiData(AsyncWebServerRequest *request) {
 
 void CalidWebServer::handleApiLogs(AsyncWebServerRequest *request) {
     if (!authenticate(request)) return;
-    if (LittleFS.exists("/log.txt")) {
-        request->send(LittleFS, "/log.txt", "text/plain");
-    } else {
+    logger.flush();
+
+    uint32_t first = logger.firstSegment();
+    uint32_t last = logger.lastSegment();
+    if (!LittleFS.exists(logger.segmentPath(last))) {
         request->send(200, "text/plain", "No logs found.");
+        return;
     }
+
+    // Segments are concatenated oldest first; one may be rotated away mid-stream, which is skipped
+    struct LogStream {
+        uint32_t seq;
+        uint32_t last;
+        File file;
+    };
+    std::shared_ptr<LogStream> stream = std::make_shared<LogStream>();
+    stream->seq = first;
+    stream->last = last;
+
+    #ifdef CALID_LOG_BINARY
+    const char* contentType = "application/octet-stream"; // Packed LogRecord entries
+    #else
+    const char* contentType = "text/plain";
+    #endif
+    AsyncWebServerResponse *response = request->beginChunkedResponse(contentType,
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+            while (written < maxLen) {
+                if (!stream->file) {
+                    if (stream->seq > stream->last) break;
+                    stream->file = LittleFS.open(logger.segmentPath(stream->seq++), "r");
+                    continue;
+                }
+                size_t n = stream->file.read(buffer + written, maxLen - written);
+                if (n == 0) {
+                    stream->file.close();
+                    stream->file = File();
+                    continue;
+                }
+                written += n;
+            }
+            return written;
+        });
+    request->send(response);
 }
 
 void CalidWebServer::handleApiSystem(AsyncWebServerRequest *request) {
@@ -233,7 +421,29 @@ void CalidWebServer::handleApiSystem(AsyncWebServerRequest *request) {
     doc["uptime"] = health.uptime;
     doc["rssi"] = health.rssi;
     doc["resetReason"] = health.resetReason;
+    doc["configWrites"] = health.configWrites;
+    doc["configWritesSkipped"] = health.configWritesSkipped;
     doc["sdkVersion"] = ESP.getSdkVersion();
+    doc["webInflight"] = _inflight.load();
+    doc["webRejected"] = metrics.webRejectedBusy.load() + metrics.webRejectedMemory.load();
+    BootProfile::toJson(doc["boot"].to<JsonObject>());
+    HeapMonitor::toJson(doc["heap"].to<JsonObject>());
+    JsonObject wifi = doc["wifi"].to<JsonObject>();
+    wifi["associationMs"] = wifiConnectStats.associationMs;
+    wifi["fastPath"] = wifiConnectStats.fastPath;
+    wifi["leaseReused"] = wifiConnectStats.leaseReused;
+    wifi["staticIp"] = config.staticIp;
+    wifi["channel"] = WiFi.channel();
+    wifi["bssid"] = WiFi.BSSIDstr();
+    #ifdef CALID_PIPELINE
+    Pipeline::toJson(doc["tasks"].to<JsonArray>());
+    #endif
+    Scheduler::toJson(doc["scheduler"].to<JsonObject>());
+    JsonObject power = doc["power"].to<JsonObject>();
+    DutyCycle::toJson(power);
+    PowerManager::toJson(power["sleep"].to<JsonObject>());
+    TimeSync::toJson(doc["time"].to<JsonObject>());
+    EdgeCapture::toJson(doc["edges"].to<JsonArray>());
     #ifdef ESP32
     doc["chipModel"] = ESP.getChipModel();
     doc["chipRevision"] = ESP.getChipRevision();
@@ -250,6 +460,7 @@ void CalidWebServer::handleApiScanI2C(AsyncWebServerRequest *request) {
     if (!authenticate(request)) return;
     JsonDocument doc;
     JsonArray addresses = doc.to<JsonArray>();
+    SensorLock lock; // The acquisition task may be mid-transaction
     
     byte error, address;
     for(address = 1; address < 127; address++) {
@@ -289,15 +500,188 @@ void CalidWebServer::handleApiWifiScan(AsyncWebServerRequest *request) {
     WiFi.scanDelete();
 }
 
+// Streams history as chunked JSON; only one cursor record and one formatted point live in RAM
+struct HistoryStream {
+    HistoryCursor cursor;
+    String header;
+    size_t headerPos = 0;
+    char pending[80];
+    size_t pendingLen = 0;
+    size_t pendingPos = 0;
+    bool first = true;
+    bool done = false;
+
+    HistoryStream(HistoryTier tier, uint32_t channel, uint32_t from, uint32_t to, uint32_t step)
+        : cursor(tier, channel, from, to, step) {}
+};
+
+void CalidWebServer::handleApiHistory(AsyncWebServerRequest *request) {
+    if (!request->hasParam("channel")) {
+        request->send(400, "application/json", "{\"error\":\"channel is required (e.g. 4/Temperature)\"}");
+        return;
+    }
+
+    String channel = request->getParam("channel")->value();
+    int slash = channel.indexOf('/');
+    if (slash < 1) {
+        request->send(400, "application/json", "{\"error\":\"channel must be <pin>/<type>[/<device>]\"}");
+        return;
+    }
+
+    uint32_t to = request->hasParam("to") ? strtoul(request->getParam("to")->value().c_str(), NULL, 10) : 0xFFFFFFFFUL;
+    uint32_t from = request->hasParam("from") ? strtoul(request->getParam("from")->value().c_str(), NULL, 10) : 0;
+    uint32_t step = request->hasParam("step") ? strtoul(request->getParam("step")->value().c_str(), NULL, 10) : 0;
+    if (step == 0) {
+        // Default to at most ~720 points over a bounded range, raw samples otherwise
+        step = (to != 0xFFFFFFFFUL && to > from) ? (to - from) / 720 : 1;
+        if (step == 0) step = 1;
+    }
+
+    HistoryTier tier = HistoryStore::tierFor(step, from);
+    // Buckets finer than the tier holds would just repeat its records
+    if (step < HistoryStore::tierSeconds(tier)) step = HistoryStore::tierSeconds(tier);
+    uint32_t id = HistoryStore::channelId(channel);
+    std::shared_ptr<HistoryStream> stream = std::make_shared<HistoryStream>(tier, id, from, to, step);
+    // The channel is caller-supplied, so let ArduinoJson escape it; "points" is streamed after
+    JsonDocument head;
+    head["channel"] = channel;
+    head["step"] = step;
+    serializeJson(head, stream->header);
+    stream->header.remove(stream->header.length() - 1);
+    stream->header += ",\"points\":[";
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+
+            if (stream->headerPos < stream->header.length()) {
+                size_t n = stream->header.length() - stream->headerPos;
+                if (n > maxLen) n = maxLen;
+                memcpy(buffer, stream->header.c_str() + stream->headerPos, n);
+                stream->headerPos += n;
+                written = n;
+                if (stream->headerPos < stream->header.length()) return written;
+                stream->header = String();
+                stream->headerPos = 0;
+            }
+
+            while (written < maxLen) {
+                if (stream->pendingPos < stream->pendingLen) {
+                    size_t n = stream->pendingLen - stream->pendingPos;
+                    if (n > maxLen - written) n = maxLen - written;
+                    memcpy(buffer + written, stream->pending + stream->pendingPos, n);
+                    stream->pendingPos += n;
+                    written += n;
+                    continue;
+                }
+                if (stream->done) break;
+
+                HistoryPoint p;
+                if (stream->cursor.next(p)) {
+                    int n = snprintf(stream->pending, sizeof(stream->pending), "%s[%lu,%.3f,%.3f,%.3f]",
+                                     stream->first ? "" : ",", (unsigned long)p.time, p.avg, p.min, p.max);
+                    stream->first = false;
+                    stream->pendingLen = (n > 0) ? (size_t)n : 0;
+                } else {
+                    stream->pendingLen = strlcpy(stream->pending, "]}", sizeof(stream->pending));
+                    stream->done = true;
+                }
+                stream->pendingPos = 0;
+            }
+            return written;
+        });
+    request->send(response);
+}
+
+struct MetricsStream {
+    MetricsCursor cursor;
+    char pending[192];
+    size_t pendingLen = 0;
+    size_t pendingPos = 0;
+    bool done = false;
+};
+
+void CalidWebServer::handleMetrics(AsyncWebServerRequest *request) {
+    std::shared_ptr<MetricsStream> stream = std::make_shared<MetricsStream>();
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("text/plain; version=0.0.4",
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+            while (written < maxLen) {
+                if (stream->pendingPos < stream->pendingLen) {
+                    size_t n = stream->pendingLen - stream->pendingPos;
+                    if (n > maxLen - written) n = maxLen - written;
+                    memcpy(buffer + written, stream->pending + stream->pendingPos, n);
+                    stream->pendingPos += n;
+                    written += n;
+                    continue;
+                }
+                if (stream->done) break;
+
+                if (metricsNextLine(stream->cursor, stream->pending, sizeof(stream->pending))) {
+                    stream->pendingLen = strlen(stream->pending);
+                } else {
+                    stream->pendingLen = 0;
+                    stream->done = true;
+                }
+                stream->pendingPos = 0;
+            }
+            return written;
+        });
+    request->send(response);
+}
+
+struct TraceStream {
+    TraceCursor cursor;
+    char pending[224];
+    size_t pendingLen = 0;
+    size_t pendingPos = 0;
+    bool done = false;
+};
+
+// Chrome trace-event JSON; open the download in ui.perfetto.dev or chrome://tracing
+void CalidWebServer::handleApiTrace(AsyncWebServerRequest *request) {
+    std::shared_ptr<TraceStream> stream = std::make_shared<TraceStream>();
+
+    AsyncWebServerResponse *response = request->beginChunkedResponse("application/json",
+        [stream](uint8_t *buffer, size_t maxLen, size_t index) -> size_t {
+            size_t written = 0;
+            while (written < maxLen) {
+                if (stream->pendingPos < stream->pendingLen) {
+                    size_t n = stream->pendingLen - stream->pendingPos;
+                    if (n > maxLen - written) n = maxLen - written;
+                    memcpy(buffer + written, stream->pending + stream->pendingPos, n);
+                    stream->pendingPos += n;
+                    written += n;
+                    continue;
+                }
+                if (stream->done) break;
+
+                if (traceNextChunk(stream->cursor, stream->pending, sizeof(stream->pending))) {
+                    stream->pendingLen = strlen(stream->pending);
+                } else {
+                    stream->pendingLen = 0;
+                    stream->done = true;
+                }
+                stream->pendingPos = 0;
+            }
+            return written;
+        });
+    response->addHeader("Content-Disposition", "attachment; filename=\"calid-trace.json\"");
+    request->send(response);
+}
+
 void CalidWebServer::handleUpdateUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final) {
     if (!index) {
-        Serial.printf("Update Start: %s\n", filename.c_str());
+        LOGI(LOG_MOD_OTA, "Upload start: %s", filename.c_str());
         
         #ifdef ESP32
         int cmd = (filename.indexOf("fs") > -1 || filename.indexOf("data") > -1) ? U_SPIFFS : U_FLASH;
         #else
         int cmd = (filename.indexOf("fs") > -1 || filename.indexOf("data") > -1) ? U_FS : U_FLASH;
         #endif
+        // The new firmware migrates from config.json if its schema differs
+        if (cmd == U_FLASH) config.exportJson();
 
         #ifdef ESP8266
         Update.runAsync(true);
@@ -305,14 +689,14 @@ void CalidWebServer::handleUpdateUpload(AsyncWebServerRequest *request, String f
         #else
         if (!Update.begin(UPDATE_SIZE_UNKNOWN, cmd)) {
         #endif
-            Update.printError(Serial);
+            LOGE(LOG_MOD_OTA, "Upload begin failed, error %d", (int)Update.getError());
         }
     }
     if (!Update.hasError()) {
-        if (Update.write(data, len) != len) Update.printError(Serial);
+        if (Update.write(data, len) != len) LOGE(LOG_MOD_OTA, "Upload write failed, error %d", (int)Update.getError());
     }
     if (final) {
-        if (Update.end(true)) Serial.printf("Update Success: %uB\n", index + len);
-        else Update.printError(Serial);
+        if (Update.end(true)) LOGI(LOG_MOD_OTA, "Upload success: %uB", (unsigned)(index + len));
+        else LOGE(LOG_MOD_OTA, "Upload finalise failed, error %d", (int)Update.getError());
     }
 }
\ No newline at end of file
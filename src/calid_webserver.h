@@ -8,6 +8,23 @@
 #endif
 #include <ESPAsyncWebServer.h>
 #include <DNSServer.h>
+#include <atomic>
+
+// Admission control: the sensor pipeline shares this heap, so UI/scrape load is
+// shed with a 503 before handlers start allocating documents.
+#if defined(ESP8266)
+#define WEB_MAX_INFLIGHT 2
+#define WEB_HEAP_WATERMARK 12288
+#else
+#define WEB_MAX_INFLIGHT 4
+#define WEB_HEAP_WATERMARK 32768
+#endif
+#define WEB_RETRY_AFTER_SECONDS "2"
+
+// Per-request heap budgets (JsonDocument + serialized String + response)
+#define WEB_BUDGET_SMALL 1024
+#define WEB_BUDGET_JSON 3072
+#define WEB_BUDGET_LARGE 6144
 
 class CalidWebServer {
 public:
@@ -22,14 +39,23 @@ private:
     // API Handlers
     void handleApiConfigSave(AsyncWebServerRequest *request);
     void handleApiConfigGet(AsyncWebServerRequest *request);
+    void handleApiConfigExport(AsyncWebServerRequest *request);
     void handleApiLogs(AsyncWebServerRequest *request);
     void handleApiData(AsyncWebServerRequest *request);
     void handleApiSystem(AsyncWebServerRequest *request);
     void handleApiScanI2C(AsyncWebServerRequest *request);
     void handleApiWifiScan(AsyncWebServerRequest *request);
+    void handleApiHistory(AsyncWebServerRequest *request);
+    void handleMetrics(AsyncWebServerRequest *request);
+    void handleApiTrace(AsyncWebServerRequest *request);
     
     // Auth
     bool authenticate(AsyncWebServerRequest *request);
+
+    // Admission control
+    std::atomic<int> _inflight;
+    std::atomic<uint32_t> _reservedHeap;
+    bool admit(AsyncWebServerRequest *request, size_t budget);
     
     // OTA Handlers
     void handleUpdateUpload(AsyncWebServerRequest *request, String filename, size_t index, uint8_t *data, size_t len, bool final);
@@ -1,5 +1,10 @@
 #include "config.h"
+#include "logging.h"
+#include "trace.h"
+#include "heap_monitor.h"
 #include <LittleFS.h>
+#include <type_traits>
+#include <functional>
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
 #include <user_interface.h>
@@ -10,15 +15,159 @@
 
 Config config;
 
+struct ConfigImageHeader {
+    uint32_t magic;
+    uint16_t schemaVersion;
+    uint16_t reserved;
+    uint32_t size;
+    uint32_t crc;
+    uint32_t writeCount; // Lifetime persisted saves, for wear tracking
+    uint32_t jsonCrc;    // config.json the image was last imported from or exported to
+};
+
+#define CONFIG_IMAGE_MAGIC 0x43464733 // "CFG3"
+
+// CRC of the image last read from or written to flash; save() is a no-op while it matches
+static uint32_t persistedCrc = 0;
+static bool persistedValid = false;
+static uint32_t writeCount = 0;
+static uint32_t skippedWrites = 0;
+static uint32_t syncedJsonCrc = 0;
+
+static_assert(std::is_trivially_copyable<Config>::value, "Config is stored as a raw image and must stay POD");
+
+// Continues a CRC-32 over more data; start from 0
+static uint32_t crc32Update(uint32_t crc, const uint8_t* data, size_t len) {
+    #ifdef ESP32
+    return crc32_le(crc, data, len);
+    #else
+    crc = ~crc;
+    for (size_t i = 0; i < len; i++) {
+        crc ^= data[i];
+        for (int b = 0; b < 8; b++) crc = (crc >> 1) ^ (0xEDB88320 & (0 - (crc & 1)));
+    }
+    return ~crc;
+    #endif
+}
+
+uint32_t configCrc32(const uint8_t* data, size_t len) {
+    return crc32Update(0, data, len);
+}
+
+// 0 when the file does not exist
+static uint32_t fileCrc32(const char* path) {
+    File f = LittleFS.open(path, "r");
+    if (!f) return 0;
+    uint8_t buf[128];
+    uint32_t crc = 0;
+    size_t n;
+    while ((n = f.read(buf, sizeof(buf))) > 0) crc = crc32Update(crc, buf, n);
+    f.close();
+    return crc;
+}
+
+// Writes to <path>.tmp and renames over <path>, so a power cut leaves either the
+// old or the new file, never a truncated one
+static bool writeAtomically(const char* path, std::function<bool(File&)> writer) {
+    String tmp = String(path) + ".tmp";
+    File f = LittleFS.open(tmp, "w");
+    if (!f) return false;
+    bool ok = writer(f);
+    f.close();
+    if (!ok || !LittleFS.rename(tmp, path)) {
+        LittleFS.remove(tmp);
+        LOGE(LOG_MOD_CONFIG, "Failed to write %s", path);
+        return false;
+    }
+    return true;
+}
+
 bool Config::load() {
+    uint32_t jsonCrc = fileCrc32(CONFIG_FILE);
+    bool image = loadBinary();
+    if (image && (!jsonCrc || jsonCrc == syncedJsonCrc)) return true;
+
+    // First boot after an upgrade or a schema change, or config.json was replaced
+    // since the image was written: import it
+    if (!loadJson()) return image;
+    LOGI(LOG_MOD_CONFIG, "Imported %s", CONFIG_FILE);
+    syncedJsonCrc = jsonCrc;
+    saveBinary();
+    return true;
+}
+
+bool Config::save() {
+    TRACE_SCOPE("config.save", "flash");
+    uint32_t crc = configCrc32((const uint8_t*)this, sizeof(Config));
+    if (persistedValid && crc == persistedCrc) {
+        skippedWrites++;
+        LOGD(LOG_MOD_CONFIG, "Config unchanged, skipping write");
+        return true;
+    }
+
+    return saveBinary();
+}
+
+bool Config::exportJson() {
+    if (!saveJson()) return false;
+    // Rebinds the image to the new file, so it is not imported back on the next boot
+    syncedJsonCrc = fileCrc32(CONFIG_FILE);
+    return saveBinary();
+}
+
+bool Config::loadBinary() {
+    File f = LittleFS.open(CONFIG_BIN_FILE, "r");
+    if (!f) return false;
+
+    ConfigImageHeader h;
+    bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+              h.magic == CONFIG_IMAGE_MAGIC &&
+              h.schemaVersion == CONFIG_SCHEMA_VERSION &&
+              h.size == sizeof(Config);
+
+    // Read into a scratch copy so a corrupt image never half-overwrites the defaults
+    Config image;
+    ok = ok && f.read((uint8_t*)&image, sizeof(image)) == sizeof(image) &&
+         configCrc32((const uint8_t*)&image, sizeof(image)) == h.crc;
+    f.close();
+
+    if (!ok) {
+        LOGW(LOG_MOD_CONFIG, "Binary config missing or stale, falling back to JSON");
+        return false;
+    }
+    memcpy((void*)this, &image, sizeof(image));
+    persistedCrc = h.crc;
+    persistedValid = true;
+    writeCount = h.writeCount;
+    syncedJsonCrc = h.jsonCrc;
+    return true;
+}
+
+bool Config::saveBinary() {
+    ConfigImageHeader h = { CONFIG_IMAGE_MAGIC, CONFIG_SCHEMA_VERSION, 0, sizeof(Config),
+                            configCrc32((const uint8_t*)this, sizeof(Config)), writeCount + 1, syncedJsonCrc };
+
+    bool ok = writeAtomically(CONFIG_BIN_FILE, [this, &h](File& f) {
+        return f.write((const uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+               f.write((const uint8_t*)this, sizeof(Config)) == sizeof(Config);
+    });
+    if (ok) {
+        persistedCrc = h.crc;
+        persistedValid = true;
+        writeCount = h.writeCount;
+    }
+    return ok;
+}
+
+bool Config::loadJson() {
     if (!LittleFS.exists(CONFIG_FILE)) {
-        Serial.println("Config file not found, using defaults.");
+        LOGW(LOG_MOD_CONFIG, "Config file not found, using defaults");
         return false;
     }
 
     File configFile = LittleFS.open(CONFIG_FILE, "r");
     if (!configFile) {
-        Serial.println("Failed to open config file.");
+        LOGE(LOG_MOD_CONFIG, "Failed to open config file");
         return false;
     }
 
@@ -27,12 +176,17 @@ bool Config::load() {
     configFile.close();
 
     if (error) {
-        Serial.println("Failed to parse config file, using defaults.");
+        LOGE(LOG_MOD_CONFIG, "Failed to parse config file (%s), using defaults", error.c_str());
         return false;
     }
 
     strlcpy(ssid, doc["ssid"] | "", sizeof(ssid));
     strlcpy(password, doc["password"] | "", sizeof(password));
+    staticIp = doc["staticIp"] | false;
+    strlcpy(staticAddress, doc["staticAddress"] | "", sizeof(staticAddress));
+    strlcpy(staticGateway, doc["staticGateway"] | "", sizeof(staticGateway));
+    strlcpy(staticSubnet, doc["staticSubnet"] | "255.255.255.0", sizeof(staticSubnet));
+    strlcpy(staticDns, doc["staticDns"] | "", sizeof(staticDns));
     strlcpy(apiEndpoint, doc["apiEndpoint"] | "", sizeof(apiEndpoint));
     strlcpy(sensorId, doc["sensorId"] | "ESP-Device", sizeof(sensorId));
     strlcpy(apiKey, doc["apiKey"] | "", sizeof(apiKey));
@@ -47,15 +201,22 @@ bool Config::load() {
     JsonArray sensorsArr = doc["sensors"];
     int i = 0;
     for (JsonObject s : sensorsArr) {
-        if (i >= MAX_SENSORS) break;
+        if (i >= MAX_SENSORS) {
+            LOGW(LOG_MOD_CONFIG, "Config lists more than %d sensors, ignoring the rest", MAX_SENSORS);
+            break;
+        }
         strlcpy(sensors[i].type, s["type"] | "none", sizeof(sensors[i].type));
         sensors[i].pin = s["pin"] | 0;
         sensors[i].i2cAddress = s["i2cAddress"] | 0x76;
         sensors[i].i2cMultiplexerChannel = s["i2cMultiplexerChannel"] | -1;
         sensors[i].tempOffset = s["tempOffset"] | 0.0f;
         sensors[i].humOffset = s["humOffset"] | 0.0f;
+        sensors[i].resolution = s["resolution"] | 12;
         i++;
     }
+    sensorCount = i;
+    i2cTimeoutMs = doc["i2cTimeoutMs"] | 50;
+    adaptiveSampling = doc["adaptiveSampling"] | false;
 
     strlcpy(mqttBroker, doc["mqttBroker"] | "mqtt.calid.io", sizeof(mqttBroker));
     mqttPort = doc["mqttPort"] | 1883;
@@ -63,14 +224,28 @@ bool Config::load() {
     strlcpy(mqttPassword, doc["mqttPassword"] | "", sizeof(mqttPassword));
     strlcpy(mqttTopicPrefix, doc["mqttTopicPrefix"] | "calid", sizeof(mqttTopicPrefix));
     mqttEnabled = doc.containsKey("mqttEnabled") ? doc["mqttEnabled"].as<bool>() : true;
+    dutyCycle = doc["dutyCycle"] | false;
+    sleepSeconds = doc["sleepSeconds"] | 300;
+    uploadEveryWakes = doc["uploadEveryWakes"] | 12;
+    uploadThreshold = doc["uploadThreshold"] | 0.0f;
+    setupButtonPin = doc["setupButtonPin"] | -1;
+    wifiSleep = doc["wifiSleep"] | 1;
+    listenInterval = doc["listenInterval"] | 1;
+    logBudget = doc["logBudget"] | 65536;
+    strlcpy(logLevels, doc["logLevels"] | "*=info", sizeof(logLevels));
 
     return true;
 }
 
-bool Config::save() {
+bool Config::saveJson() {
     JsonDocument doc;
     doc["ssid"] = ssid;
     doc["password"] = password;
+    doc["staticIp"] = staticIp;
+    doc["staticAddress"] = staticAddress;
+    doc["staticGateway"] = staticGateway;
+    doc["staticSubnet"] = staticSubnet;
+    doc["staticDns"] = staticDns;
     doc["apiEndpoint"] = apiEndpoint;
     doc["sensorId"] = sensorId;
     doc["apiKey"] = apiKey;
@@ -82,7 +257,7 @@ bool Config::save() {
     doc["firmwareUrl"] = firmwareUrl;
 
     JsonArray sensorsArr = doc["sensors"].to<JsonArray>();
-    for (int i = 0; i < MAX_SENSORS; i++) {
+    for (int i = 0; i < sensorCount; i++) {
         JsonObject s = sensorsArr.add<JsonObject>();
         s["type"] = sensors[i].type;
         s["pin"] = sensors[i].pin;
@@ -90,23 +265,31 @@ bool Config::save() {
         s["i2cMultiplexerChannel"] = sensors[i].i2cMultiplexerChannel;
         s["tempOffset"] = sensors[i].tempOffset;
         s["humOffset"] = sensors[i].humOffset;
+        s["resolution"] = sensors[i].resolution;
     }
 
+    doc["i2cTimeoutMs"] = i2cTimeoutMs;
+    doc["adaptiveSampling"] = adaptiveSampling;
+
     doc["mqttBroker"] = mqttBroker;
     doc["mqttPort"] = mqttPort;
     doc["mqttUser"] = mqttUser;
     doc["mqttPassword"] = mqttPassword;
     doc["mqttTopicPrefix"] = mqttTopicPrefix;
     doc["mqttEnabled"] = mqttEnabled;
+    doc["dutyCycle"] = dutyCycle;
+    doc["sleepSeconds"] = sleepSeconds;
+    doc["uploadEveryWakes"] = uploadEveryWakes;
+    doc["uploadThreshold"] = uploadThreshold;
+    doc["setupButtonPin"] = setupButtonPin;
+    doc["wifiSleep"] = wifiSleep;
+    doc["listenInterval"] = listenInterval;
+    doc["logBudget"] = logBudget;
+    doc["logLevels"] = logLevels;
 
-    File configFile = LittleFS.open(CONFIG_FILE, "w");
-    if (!configFile) {
-        return false;
-    }
-
-    serializeJson(doc, configFile);
-    configFile.close();
-    return true;
+    return writeAtomically(CONFIG_FILE, [&doc](File& f) {
+        return serializeJson(doc, f) > 0;
+    });
 }
 
 String Config::getAdoptionCode() {
@@ -128,7 +311,17 @@ SystemHealth Config::getSystemHealth() {
     SystemHealth health;
     health.rssi = WiFi.RSSI();
     health.uptime = millis() / 1000;
-    health.freeHeap = ESP.getFreeHeap();
+    HeapMonitor::sample();
+    health.freeHeap = HeapMonitor::freeHeap();
+    health.largestFreeBlock = HeapMonitor::largestBlock();
+    health.heapFragmentation = HeapMonitor::fragmentation();
+    health.minFreeHeap = HeapMonitor::minFreeHeap();
+    health.minStackTask = "";
+    health.minStackFree = HeapMonitor::minStackFree(&health.minStackTask);
+    health.allocFailures = allocStats.failures.load(std::memory_order_relaxed);
+    health.tlsAtRisk = HeapMonitor::tlsAtRisk();
+    health.configWrites = writeCount;
+    health.configWritesSkipped = skippedWrites;
     
     #ifdef ESP32
     esp_reset_reason_t reason = esp_reset_reason();
@@ -4,28 +4,54 @@
 #include <Arduino.h>
 #include <ArduinoJson.h>
 
-#define MAX_SENSORS 4
+// Sensor table capacity. Only the first config.sensorCount slots are used; drivers
+// and reading buffers are allocated for those alone.
+#if defined(ESP8266)
+#define MAX_SENSORS 16
+#else
+#define MAX_SENSORS 64
+#endif
 #define CONFIG_FILE "/config.json"
+#define CONFIG_BIN_FILE "/config.bin"
+// Bump whenever a field is added, removed, resized or reordered in Config
+#define CONFIG_SCHEMA_VERSION 8
 
+// Kept compact (32 bytes) since the table is stored in full in the config image
 struct SensorConfig {
-    char type[32] = "none"; // Matches backend strings like 'dht22', 'bme280', etc.
-    int pin = 0;
-    int i2cAddress = 0x76; 
-    int i2cMultiplexerChannel = -1; 
+    char type[16] = "none"; // Matches backend strings like 'dht22', 'bme280', etc.
+    int16_t pin = 0;
+    uint8_t i2cAddress = 0x76; 
+    int8_t i2cMultiplexerChannel = -1; // 0-7 on mux 0x70, 8-15 on 0x71, ...
     float tempOffset = 0.0f;
     float humOffset = 0.0f;
+    uint8_t resolution = 12; // DS18B20 bits (9-12), trades conversion time for precision
 };
 
 struct SystemHealth {
     int rssi;
     uint32_t uptime;
     uint32_t freeHeap;
+    uint32_t largestFreeBlock;
+    uint8_t heapFragmentation;    // Percent of free heap outside the largest block
+    uint32_t minFreeHeap;         // Lowest free heap seen since boot
+    uint32_t minStackFree;        // Smallest stack headroom across tasks, bytes
+    const char* minStackTask;
+    uint32_t allocFailures;
+    bool tlsAtRisk;               // Next TLS session is unlikely to fit in the heap
+    uint32_t configWrites;        // Lifetime config saves that reached flash
+    uint32_t configWritesSkipped; // Saves skipped since boot because nothing changed
     String resetReason;
 };
 
 struct Config {
     char ssid[32] = "";
     char password[32] = "";
+    // Static addressing skips DHCP on every association
+    bool staticIp = false;
+    char staticAddress[16] = "";
+    char staticGateway[16] = "";
+    char staticSubnet[16] = "255.255.255.0";
+    char staticDns[16] = "";
     char apiEndpoint[128] = "";
     char sensorId[32] = "ESP-Device";
     char apiKey[64] = "";
@@ -41,7 +67,11 @@ struct Config {
     char firmwareUrl[128] = "";
 
     // Multi-sensor support
+    uint8_t sensorCount = 0;
     SensorConfig sensors[MAX_SENSORS];
+    // Per-transaction I2C timeout, bounds how long a wedged device can stall the bus
+    uint16_t i2cTimeoutMs = 50;
+    bool adaptiveSampling = false; // Per-slot rate from signal dynamics instead of a fixed minute
 
     char mqttBroker[64] = "mqtt.calid.io";
     int mqttPort = 1883;
@@ -50,12 +80,40 @@ struct Config {
     char mqttTopicPrefix[32] = "calid";
     bool mqttEnabled = true;
 
+    // Deep-sleep duty cycle: sample into RTC memory, bring the radio up for batches
+    bool dutyCycle = false;
+    uint32_t sleepSeconds = 300;
+    uint8_t uploadEveryWakes = 12;
+    float uploadThreshold = 0.0f; // Change since the last upload that forces one early, 0 disables
+    int8_t setupButtonPin = -1;   // Held low at wake to stay up with the web UI
+    // Between tasks while always on: 0 none, 1 modem sleep, 2 light sleep
+    uint8_t wifiSleep = 1;
+    uint8_t listenInterval = 1;   // Beacons per radio wake; 1 is the SDK's own min modem sleep
+
+    // Total flash budget for log segments
+    uint32_t logBudget = 65536;
+    // Per-module runtime log levels, e.g. "*=info,mqtt=debug"
+    char logLevels[64] = "*=info";
+
     bool load();
     bool save();
+    // Writes config.json, secrets included in plaintext. Only on request and
+    // before a firmware update, which may change the schema and migrate from it.
+    bool exportJson();
+
+    // Fixed-layout image with CRC, the only thing save() writes. JSON stays the
+    // import/export and migration format; a config.json that differs from the one
+    // the image last synced with is imported on boot.
+    bool loadBinary();
+    bool saveBinary();
+    bool loadJson();
+    bool saveJson();
     String getAdoptionCode();
     SystemHealth getSystemHealth();
 };
 
 extern Config config;
 
+uint32_t configCrc32(const uint8_t* data, size_t len);
+
 #endif // CONFIG_H
@@ -0,0 +1,181 @@
+#include "config_reload.h"
+#include <new>
+#include "sensor.h"
+#include "mqtt_manager.h"
+#include "logging.h"
+#include "pipeline.h"
+#include "time_sync.h"
+#include "scheduler.h"
+#include "duty_cycle.h"
+#include "power_manager.h"
+
+volatile uint32_t ConfigReload::_pendingChanges = CONFIG_CHANGE_NONE;
+volatile uint32_t ConfigReload::_pendingSlots[CONFIG_SLOT_WORDS] = {};
+unsigned long ConfigReload::_restartAt = 0;
+int ConfigReload::_task = -1;
+
+std::unique_ptr<Config> ConfigReload::snapshot() {
+    return std::unique_ptr<Config>(new (std::nothrow) Config(config));
+}
+
+ConfigDiff ConfigReload::diff(const Config& before, const Config& after) {
+    ConfigDiff d;
+
+    if (strcmp(before.ssid, after.ssid) != 0 || strcmp(before.password, after.password) != 0 ||
+        before.staticIp != after.staticIp ||
+        strcmp(before.staticAddress, after.staticAddress) != 0 ||
+        strcmp(before.staticGateway, after.staticGateway) != 0 ||
+        strcmp(before.staticSubnet, after.staticSubnet) != 0 ||
+        strcmp(before.staticDns, after.staticDns) != 0) {
+        d.changes |= CONFIG_CHANGE_WIFI;
+    }
+
+    // Topics are derived from sensorId, so a rename needs a fresh session too
+    if (before.mqttEnabled != after.mqttEnabled ||
+        before.mqttPort != after.mqttPort ||
+        strcmp(before.mqttBroker, after.mqttBroker) != 0 ||
+        strcmp(before.mqttUser, after.mqttUser) != 0 ||
+        strcmp(before.mqttPassword, after.mqttPassword) != 0 ||
+        strcmp(before.mqttTopicPrefix, after.mqttTopicPrefix) != 0 ||
+        strcmp(before.sensorId, after.sensorId) != 0) {
+        d.changes |= CONFIG_CHANGE_MQTT;
+    }
+
+    if (before.utcOffset != after.utcOffset || strcmp(before.ntpServer, after.ntpServer) != 0) {
+        d.changes |= CONFIG_CHANGE_NTP;
+    }
+
+    if (before.logBudget != after.logBudget || strcmp(before.logLevels, after.logLevels) != 0) {
+        d.changes |= CONFIG_CHANGE_LOGGING;
+    }
+
+    if (before.testingMode != after.testingMode) {
+        d.changes |= CONFIG_CHANGE_TESTING_MODE;
+    }
+
+    if (before.dutyCycle != after.dutyCycle || before.sleepSeconds != after.sleepSeconds ||
+        before.uploadEveryWakes != after.uploadEveryWakes || before.uploadThreshold != after.uploadThreshold ||
+        before.setupButtonPin != after.setupButtonPin) {
+        d.changes |= CONFIG_CHANGE_POWER;
+    }
+
+    if (before.wifiSleep != after.wifiSleep || before.listenInterval != after.listenInterval) {
+        d.changes |= CONFIG_CHANGE_WIFI_SLEEP;
+    }
+
+    if (before.i2cTimeoutMs != after.i2cTimeoutMs) {
+        d.changes |= CONFIG_CHANGE_SENSORS;
+    }
+
+    // Slots past the shorter table were added or removed outright
+    int common = min(before.sensorCount, after.sensorCount);
+    int longest = max(before.sensorCount, after.sensorCount);
+    for (int i = 0; i < longest; i++) {
+        const SensorConfig& a = before.sensors[i];
+        const SensorConfig& b = after.sensors[i];
+        if (i >= common || strcmp(a.type, b.type) != 0 || a.pin != b.pin ||
+            a.i2cAddress != b.i2cAddress || a.i2cMultiplexerChannel != b.i2cMultiplexerChannel ||
+            a.resolution != b.resolution) {
+            d.markSlot(i);
+            d.changes |= CONFIG_CHANGE_SENSORS;
+        } else if (a.tempOffset != b.tempOffset || a.humOffset != b.humOffset) {
+            d.changes |= CONFIG_CHANGE_OTHER;
+        }
+    }
+
+    if (strcmp(before.apiEndpoint, after.apiEndpoint) != 0 ||
+        strcmp(before.apiKey, after.apiKey) != 0 ||
+        strcmp(before.adminUser, after.adminUser) != 0 ||
+        strcmp(before.adminPassword, after.adminPassword) != 0 ||
+        strcmp(before.firmwareUrl, after.firmwareUrl) != 0 ||
+        before.adaptiveSampling != after.adaptiveSampling) {
+        d.changes |= CONFIG_CHANGE_OTHER;
+    }
+
+    return d;
+}
+
+void ConfigReload::schedule(const ConfigDiff& diff) {
+    for (int w = 0; w < CONFIG_SLOT_WORDS; w++) _pendingSlots[w] |= diff.sensorSlots[w];
+    _pendingChanges |= diff.changes;
+    Scheduler::signal(_task);
+}
+
+void ConfigReload::begin() {
+    // Polled only for the restart countdown; new diffs signal it straight away
+    _task = Scheduler::add("config", 250, 50000, loop);
+}
+
+void ConfigReload::loop() {
+    if (_restartAt != 0) {
+        if ((long)(millis() - _restartAt) >= 0) {
+            logger.flush();
+            ESP.restart();
+        }
+        return;
+    }
+
+    if (_pendingChanges == CONFIG_CHANGE_NONE) return;
+
+    ConfigDiff pending;
+    pending.changes = _pendingChanges;
+    _pendingChanges = CONFIG_CHANGE_NONE;
+    for (int w = 0; w < CONFIG_SLOT_WORDS; w++) {
+        pending.sensorSlots[w] = _pendingSlots[w];
+        _pendingSlots[w] = 0;
+    }
+
+    apply(pending);
+}
+
+void ConfigReload::apply(const ConfigDiff& diff) {
+    uint32_t changes = diff.changes;
+    if (changes & (CONFIG_CHANGE_WIFI | CONFIG_CHANGE_POWER)) {
+        // Let the HTTP response / MQTT ack go out before dropping the link
+        LOGI(LOG_MOD_CONFIG, "%s changed, restarting", (changes & CONFIG_CHANGE_WIFI) ? "WiFi credentials" : "Power mode");
+        _restartAt = millis() + 1000;
+        return;
+    }
+
+    if (changes & CONFIG_CHANGE_NTP) {
+        // The offset is applied when formatting, so only the server needs restarting
+        TimeSync::begin();
+        LOGI(LOG_MOD_CONFIG, "NTP settings applied (%s, offset %d)", config.ntpServer, config.utcOffset);
+    }
+
+    if ((changes & CONFIG_CHANGE_WIFI_SLEEP) && !DutyCycle::active()) {
+        PowerManager::apply();
+    }
+
+    if (changes & CONFIG_CHANGE_LOGGING) {
+        logger.setBudget(config.logBudget);
+        if (!logger.applyLevelSpec(config.logLevels)) {
+            LOGW(LOG_MOD_CONFIG, "Ignored invalid entries in log levels '%s'", config.logLevels);
+        }
+    }
+
+    if (changes & CONFIG_CHANGE_MQTT) {
+        MqttLock lock;
+        mqttManager.reconfigure();
+        LOGI(LOG_MOD_CONFIG, "MQTT reconnecting with new settings");
+    }
+
+    if (!config.testingMode) {
+        SensorLock lock;
+        if (changes & CONFIG_CHANGE_TESTING_MODE) {
+            // Leaving simulation: no drivers have been started yet
+            sensor.begin();
+            LOGI(LOG_MOD_CONFIG, "Simulation disabled, sensors started");
+        } else if (changes & CONFIG_CHANGE_SENSORS) {
+            sensor.configureBus();
+            int count = 0;
+            for (int i = 0; i < MAX_SENSORS; i++) {
+                if (!diff.slotChanged(i)) continue;
+                sensor.beginSlot(i);
+                count++;
+            }
+            sensor.update();
+            LOGI(LOG_MOD_CONFIG, "Re-initialised %d sensor slot(s)", count);
+        }
+    }
+}
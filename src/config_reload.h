@@ -0,0 +1,54 @@
+#ifndef CALID_CONFIG_RELOAD_H
+#define CALID_CONFIG_RELOAD_H
+
+#include <Arduino.h>
+#include <memory>
+#include "config.h"
+
+// Subsystems affected by a config change
+enum ConfigChange : uint32_t {
+    CONFIG_CHANGE_NONE         = 0,
+    CONFIG_CHANGE_WIFI         = 1 << 0, // Needs a restart
+    CONFIG_CHANGE_MQTT         = 1 << 1,
+    CONFIG_CHANGE_NTP          = 1 << 2,
+    CONFIG_CHANGE_SENSORS      = 1 << 3,
+    CONFIG_CHANGE_TESTING_MODE = 1 << 4,
+    CONFIG_CHANGE_LOGGING      = 1 << 5,
+    CONFIG_CHANGE_OTHER        = 1 << 6, // Read live on every use (API, auth, offsets)
+    CONFIG_CHANGE_POWER        = 1 << 7, // Duty cycle, needs a restart
+    CONFIG_CHANGE_WIFI_SLEEP   = 1 << 8
+};
+
+#define CONFIG_SLOT_WORDS ((MAX_SENSORS + 31) / 32)
+
+struct ConfigDiff {
+    uint32_t changes = CONFIG_CHANGE_NONE;
+    uint32_t sensorSlots[CONFIG_SLOT_WORDS] = {}; // Bit per slot whose driver must be re-created
+
+    bool empty() const { return changes == CONFIG_CHANGE_NONE; }
+    bool requiresRestart() const { return changes & (CONFIG_CHANGE_WIFI | CONFIG_CHANGE_POWER); }
+    void markSlot(int slot) { sensorSlots[slot / 32] |= (1UL << (slot % 32)); }
+    bool slotChanged(int slot) const { return sensorSlots[slot / 32] & (1UL << (slot % 32)); }
+};
+
+class ConfigReload {
+public:
+    static ConfigDiff diff(const Config& before, const Config& after);
+    // Heap copy of the live config to diff against after editing it, so the ~2.7 KB
+    // stays off the async_tcp and transport stacks; nullptr when the heap is short
+    static std::unique_ptr<Config> snapshot();
+
+    // Queues a diff to be applied from loop(); safe to call from the web server task
+    static void schedule(const ConfigDiff& diff);
+    static void begin(); // Registers loop() with the scheduler
+    static void loop();
+
+private:
+    static int _task;
+    static volatile uint32_t _pendingChanges;
+    static volatile uint32_t _pendingSlots[CONFIG_SLOT_WORDS];
+    static unsigned long _restartAt;
+    static void apply(const ConfigDiff& diff);
+};
+
+#endif
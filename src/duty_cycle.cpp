@@ -0,0 +1,368 @@
+#include "duty_cycle.h"
+#include "config.h"
+#include "sensor.h"
+#include "telemetry.h"
+#include "history_store.h"
+#include "mqtt_manager.h"
+#include "boot_profile.h"
+#include "logging.h"
+#include "time_sync.h"
+#include <Wire.h>
+
+#ifdef ESP32
+#include <esp_sleep.h>
+#endif
+
+#define DUTY_STATE_MAGIC 0x44435932 // "DCY2"
+#define DUTY_NO_TIME 0xFFFFFFFF
+
+#define DUTY_FLAG_RF_ON          0x01 // This wake has a calibrated radio (ESP8266)
+#define DUTY_FLAG_UPLOAD_PENDING 0x02 // Rebooted with the radio on to upload
+#define DUTY_FLAG_UPLOAD_FAILED  0x04 // Last attempt failed; don't retry just because the buffer is full
+
+// One reading from one wake. The sensor and reading indexes are positions in
+// allSensorData, which the config fixes; names are taken from the upload wake.
+struct DutySample {
+    uint32_t atMs;  // Read time minus DutyState::baseMs, DUTY_NO_TIME if the clock was unset
+    uint16_t wake;
+    uint8_t sensor;
+    uint8_t reading;
+    float value;
+};
+
+struct DutyState {
+    uint32_t magic;
+    uint32_t crc;         // From baseMs through the last used sample
+    uint64_t baseMs;      // UTC ms the sample stamps are relative to
+    uint64_t wakeAtMs;    // Clock estimate for the next wake (sleep start + sleep time), 0 if unset
+    uint32_t wakes;       // Timer wakes since power-on
+    uint32_t uploadedAt;  // wakes at the last upload attempt
+    uint32_t lastWakeUs;  // Wake-to-sleep of the last sample-only wake
+    uint32_t maxWakeUs;   // Since the last delivered batch
+    uint32_t sumWakeUs;
+    uint16_t sampleWakes;
+    uint16_t count;
+    uint16_t dropped;     // Oldest samples discarded while uploads kept failing
+    uint8_t perWake;      // Samples the last wake added, to see a full buffer coming
+    uint8_t flags;
+    DutySample samples[DUTY_MAX_SAMPLES];
+};
+
+#ifdef ESP32
+RTC_NOINIT_ATTR static DutyState rtcDutyState;
+#else
+static_assert(sizeof(DutyState) <= DUTY_RTC_BLOCKS * 4, "DutyState overflows its RTC blocks");
+#endif
+
+static DutyState state;
+
+DutyWake DutyCycle::_mode = DUTY_OFF;
+bool DutyCycle::_sampled = false;
+bool DutyCycle::_coldBoot = false;
+
+static uint32_t stateCrc(const DutyState& s) {
+    size_t start = offsetof(DutyState, baseMs);
+    size_t len = offsetof(DutyState, samples) - start + s.count * sizeof(DutySample);
+    return configCrc32((const uint8_t*)&s + start, len);
+}
+
+static bool loadState() {
+    #ifdef ESP32
+    state = rtcDutyState;
+    #else
+    ESP.rtcUserMemoryRead(DUTY_RTC_OFFSET, (uint32_t*)&state, sizeof(state));
+    #endif
+    return state.magic == DUTY_STATE_MAGIC && state.count <= DUTY_MAX_SAMPLES && state.crc == stateCrc(state);
+}
+
+static void storeState() {
+    state.magic = DUTY_STATE_MAGIC;
+    state.crc = stateCrc(state);
+    #ifdef ESP32
+    rtcDutyState = state;
+    #else
+    ESP.rtcUserMemoryWrite(DUTY_RTC_OFFSET, (uint32_t*)&state, sizeof(state));
+    #endif
+}
+
+static bool setupRequested() {
+    #ifdef ESP32
+    if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) return true;
+    #endif
+    if (config.setupButtonPin < 0) return false;
+    pinMode(config.setupButtonPin, INPUT_PULLUP);
+    delayMicroseconds(50);
+    return digitalRead(config.setupButtonPin) == LOW;
+}
+
+DutyWake DutyCycle::begin() {
+    if (!config.dutyCycle) return _mode = DUTY_OFF;
+    if (config.setupButtonPin < 0) {
+        // Saved before the web UI required a button; sleeping now would lock the device out
+        LOGW(LOG_MOD_SYSTEM, "Duty cycle needs a setup button pin, staying awake");
+        return _mode = DUTY_OFF;
+    }
+
+    if (!loadState()) {
+        // Power-on: the radio is calibrated, and an immediate upload shows a bad network setup early
+        memset(&state, 0, sizeof(state));
+        state.flags = DUTY_FLAG_RF_ON;
+        _coldBoot = true;
+    } else if (state.wakeAtMs) {
+        // Carries the clock across sleep; the next upload's SNTP sync measures the error
+        TimeSync::restore(state.wakeAtMs);
+    }
+
+    if (setupRequested()) {
+        LOGI(LOG_MOD_SYSTEM, "Setup button held, staying awake");
+        return _mode = DUTY_OFF;
+    }
+    return _mode = (state.flags & DUTY_FLAG_UPLOAD_PENDING) ? DUTY_UPLOAD : DUTY_SAMPLE;
+}
+
+void DutyCycle::takeSample() {
+    if (!config.testingMode) {
+        Wire.begin();
+        sensor.begin();
+        unsigned long start = millis();
+        while (sensor.initializing() && millis() - start < DUTY_INIT_BUDGET_MS) {
+            sensor.loop();
+            delay(1);
+        }
+    }
+    acquireSample();
+    _sampled = true;
+}
+
+// Appends this wake's readings; true when one crossed the upload threshold
+bool DutyCycle::record() {
+    bool crossed = false;
+    uint8_t added = 0;
+
+    for (int i = 0; i < activeSensorCount && i < 256; i++) {
+        const SensorReadings& sr = allSensorData[i];
+        if (!sr.valid) continue;
+        for (size_t r = 0; r < sr.readings.size() && r < 256; r++) {
+            float value = sr.readings[r].value;
+            if (isnan(value)) continue;
+            uint64_t stamp = sr.timestampMs;
+
+            if (config.uploadThreshold > 0) {
+                // Compared with the oldest buffered value, i.e. the first since the last upload
+                for (uint16_t k = 0; k < state.count; k++) {
+                    const DutySample& s = state.samples[k];
+                    if (s.sensor != i || s.reading != r) continue;
+                    if (fabsf(value - s.value) >= config.uploadThreshold) crossed = true;
+                    break;
+                }
+            }
+
+            if (state.count >= DUTY_MAX_SAMPLES) {
+                // Drop the oldest wake as a whole
+                uint16_t oldest = state.samples[0].wake;
+                uint16_t n = 0;
+                while (n < state.count && state.samples[n].wake == oldest) n++;
+                memmove(state.samples, state.samples + n, (state.count - n) * sizeof(DutySample));
+                state.count -= n;
+                state.dropped += n;
+            }
+            if (state.count == 0) state.baseMs = 0;
+            if (stamp && !state.baseMs) state.baseMs = stamp;
+            uint32_t atMs = DUTY_NO_TIME;
+            if (stamp && stamp >= state.baseMs && stamp - state.baseMs < DUTY_NO_TIME) atMs = stamp - state.baseMs;
+            state.samples[state.count++] = { atMs, (uint16_t)state.wakes, (uint8_t)i, (uint8_t)r, value };
+            added++;
+        }
+    }
+    state.perWake = added;
+    return crossed;
+}
+
+bool DutyCycle::uploadDue(uint32_t ahead) {
+    if (state.wakes + ahead - state.uploadedAt >= config.uploadEveryWakes) return true;
+    if (state.flags & DUTY_FLAG_UPLOAD_FAILED) return false;
+    return state.count + (ahead + 1) * state.perWake > DUTY_MAX_SAMPLES;
+}
+
+DutyWake DutyCycle::sample() {
+    state.wakes++;
+    takeSample();
+    bool crossed = record();
+    // The baseline only resets on delivery, so after a failure every wake would cross
+    // again; retries wait for the regular uploadEveryWakes cadence instead
+    if (state.flags & DUTY_FLAG_UPLOAD_FAILED) crossed = false;
+
+    if (!crossed && !_coldBoot && !uploadDue(0)) sleep();
+
+    #if defined(ESP8266)
+    if (!(state.flags & DUTY_FLAG_RF_ON)) {
+        // Woke with the radio disabled; come straight back with it calibrated
+        state.flags |= DUTY_FLAG_UPLOAD_PENDING | DUTY_FLAG_RF_ON;
+        state.wakeAtMs = TimeSync::nowMs();
+        storeState();
+        ESP.deepSleep(1, WAKE_RF_DEFAULT);
+    }
+    #endif
+    return _mode = DUTY_UPLOAD;
+}
+
+bool DutyCycle::upload() {
+    // A fresh sync also measures how far the clock drifted over the sleeps
+    TimeSync::waitForSync(DUTY_SNTP_TIMEOUT_MS);
+
+    JsonDocument doc;
+    doc["sensorId"] = config.sensorId;
+    doc["adoptionCode"] = config.getAdoptionCode();
+    doc["interval"] = config.sleepSeconds;
+    toJson(doc["power"].to<JsonObject>());
+    TimeSync::toJson(doc["clock"].to<JsonObject>());
+    JsonArray channels = doc["channels"].to<JsonArray>();
+    JsonArray samples = doc["samples"].to<JsonArray>(); // [timestampMs, channel, value]
+
+    std::vector<uint16_t> channelKeys;
+    std::vector<SensorReadings> frame(allSensorData.begin(), allSensorData.begin() + activeSensorCount);
+    auto clearFrame = [&frame]() {
+        for (auto& sr : frame) {
+            sr.fresh = true; // Buffered values, whatever this wake read
+            sr.timestampMs = 0;
+            for (auto& r : sr.readings) r.value = NAN;
+        }
+    };
+    clearFrame();
+
+    String rows = "[";
+    uint16_t skipped = 0;
+    int32_t frameWake = -1;
+    for (uint16_t k = 0; k < state.count; k++) {
+        const DutySample& s = state.samples[k];
+        // Labelled from this wake's read, so a sensor that reads nothing now can't be named
+        if (s.sensor >= activeSensorCount || !allSensorData[s.sensor].valid ||
+            s.reading >= allSensorData[s.sensor].readings.size()) {
+            skipped++;
+            continue;
+        }
+
+        uint16_t key = (s.sensor << 8) | s.reading;
+        size_t ch = 0;
+        while (ch < channelKeys.size() && channelKeys[ch] != key) ch++;
+        if (ch == channelKeys.size()) {
+            const SensorReadings& sr = allSensorData[s.sensor];
+            const Reading& r = sr.readings[s.reading];
+            channelKeys.push_back(key);
+            JsonObject c = channels.add<JsonObject>();
+            c["pin"] = sr.pin;
+            c["type"] = sr.sensorType;
+            c["reading"] = r.type;
+            c["unit"] = r.unit;
+            if (r.device.length()) c["device"] = r.device;
+        }
+
+        if (frameWake >= 0 && frameWake != s.wake) {
+            historyStore.append(frame.data(), frame.size());
+            clearFrame();
+        }
+        frameWake = s.wake;
+
+        SensorReadings& sr = frame[s.sensor];
+        sr.timestampMs = s.atMs == DUTY_NO_TIME ? 0 : state.baseMs + s.atMs;
+        sr.readings[s.reading].value = s.value;
+
+        JsonArray row = samples.add<JsonArray>();
+        if (sr.timestampMs) row.add(sr.timestampMs);
+        else row.add(nullptr);
+        row.add(ch);
+        row.add(s.value);
+        appendHttpRow(rows, sr, sr.readings[s.reading]);
+    }
+    if (frameWake >= 0) historyStore.append(frame.data(), frame.size());
+    if (skipped) LOGW(LOG_MOD_SYSTEM, "Dropped %u buffered samples with no matching sensor", skipped);
+    bool attempted = false, delivered = false;
+    if (config.mqttEnabled) {
+        attempted = true;
+        unsigned long start = millis();
+        while (!mqttManager.isConnected() && millis() - start < DUTY_MQTT_TIMEOUT_MS) {
+            mqttManager.loop();
+            delay(10);
+        }
+        String payload;
+        serializeJson(doc, payload);
+        delivered = mqttManager.publishBatch(payload);
+    }
+    if (strlen(config.apiEndpoint) > 0 && rows.length() > 1) {
+        attempted = true;
+        int code = postHttpUpload(rows + "]");
+        delivered |= code >= 200 && code < 300;
+    }
+    LOGI(LOG_MOD_SYSTEM, "Batch of %u samples %s", state.count, delivered || !attempted ? "delivered" : "not delivered");
+    return delivered || !attempted;
+}
+
+void DutyCycle::uploadAndSleep(bool connected) {
+    {
+        BootPhase phase("duty_upload");
+        // After an ESP8266 radio reboot the last wake's values are already buffered
+        if (!_sampled) takeSample();
+
+        bool delivered = connected && upload();
+        if (delivered) {
+            state.count = 0;
+            state.dropped = 0;
+            state.maxWakeUs = 0;
+            state.sumWakeUs = 0;
+            state.sampleWakes = 0;
+            state.flags &= ~DUTY_FLAG_UPLOAD_FAILED;
+        } else {
+            state.flags |= DUTY_FLAG_UPLOAD_FAILED;
+        }
+        state.uploadedAt = state.wakes;
+        mqttManager.disconnect("sleeping");
+    }
+    logger.flush();
+    sleep();
+}
+
+void DutyCycle::sleep() {
+    uint32_t awakeUs = micros();
+    if (_mode == DUTY_SAMPLE) {
+        state.lastWakeUs = awakeUs;
+        state.maxWakeUs = max(state.maxWakeUs, awakeUs);
+        state.sumWakeUs += awakeUs;
+        state.sampleWakes++;
+    }
+
+    // Only calibrate the radio on wakes that will need it
+    bool radioNext = uploadDue(1);
+    if (radioNext) state.flags |= DUTY_FLAG_RF_ON;
+    else state.flags &= ~DUTY_FLAG_RF_ON;
+    state.flags &= ~DUTY_FLAG_UPLOAD_PENDING;
+
+    uint64_t us = (uint64_t)config.sleepSeconds * 1000000ULL;
+    #if defined(ESP8266)
+    us = min(us, ESP.deepSleepMax());
+    #endif
+    uint64_t nowMs = TimeSync::nowMs();
+    state.wakeAtMs = nowMs ? nowMs + us / 1000 : 0;
+    storeState();
+
+    #if defined(ESP8266)
+    ESP.deepSleep(us, radioNext ? WAKE_RF_DEFAULT : WAKE_RF_DISABLED);
+    #else
+    esp_sleep_enable_timer_wakeup(us);
+    if (config.setupButtonPin >= 0) esp_sleep_enable_ext0_wakeup((gpio_num_t)config.setupButtonPin, 0);
+    esp_deep_sleep_start();
+    #endif
+}
+
+void DutyCycle::toJson(JsonObject obj) {
+    obj["dutyCycle"] = config.dutyCycle;
+    if (!config.dutyCycle) return;
+    obj["mode"] = _mode == DUTY_OFF ? "setup" : (_mode == DUTY_SAMPLE ? "sample" : "upload");
+    obj["wakes"] = state.wakes;
+    obj["buffered"] = state.count;
+    obj["capacity"] = DUTY_MAX_SAMPLES;
+    obj["dropped"] = state.dropped;
+    obj["lastWakeUs"] = state.lastWakeUs;
+    obj["maxWakeUs"] = state.maxWakeUs;
+    obj["avgWakeUs"] = state.sampleWakes ? state.sumWakeUs / state.sampleWakes : 0;
+    obj["targetWakeUs"] = DUTY_WAKE_TARGET_US;
+}
@@ -0,0 +1,57 @@
+#ifndef CALID_DUTY_CYCLE_H
+#define CALID_DUTY_CYCLE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "wifi_setup.h"
+
+// ESP8266 RTC user memory: the sample buffer sits right after the WiFi cache
+#define DUTY_RTC_OFFSET (WIFI_RTC_OFFSET + WIFI_RTC_BLOCKS)
+#define DUTY_RTC_BLOCKS 118
+#if defined(ESP8266)
+#define DUTY_MAX_SAMPLES 35  // What is left of the 512 bytes
+#else
+#define DUTY_MAX_SAMPLES 512
+#endif
+
+#define DUTY_INIT_BUDGET_MS 2000    // Longest a sample wake waits for drivers to come up
+#define DUTY_MQTT_TIMEOUT_MS 5000
+#define DUTY_SNTP_TIMEOUT_MS 3000
+#define DUTY_WAKE_TARGET_US 100000  // Wake-to-sleep goal for sample-only wakes
+
+enum DutyWake {
+    DUTY_OFF = 0, // Always-on operation (duty cycle disabled or setup button held)
+    DUTY_SAMPLE,  // Read sensors into RTC memory and go straight back to sleep
+    DUTY_UPLOAD   // Bring the radio up and flush the buffer
+};
+
+// Deep-sleep duty cycle. Most wakes only sample into RTC memory with the radio
+// off; every config.uploadEveryWakes wakes (or when a reading moves by more than
+// config.uploadThreshold) the batch goes out over the cached fast WiFi path.
+class DutyCycle {
+public:
+    // Decides what this boot is for; call straight after config.load()
+    static DutyWake begin();
+
+    // Samples into the RTC buffer and sleeps, unless an upload is due
+    static DutyWake sample();
+
+    // Publishes the buffer over MQTT and HTTP, then sleeps. Does not return.
+    static void uploadAndSleep(bool connected);
+
+    static bool active() { return _mode != DUTY_OFF; }
+    static void toJson(JsonObject obj);
+
+private:
+    static DutyWake _mode;
+    static bool _sampled;
+    static bool _coldBoot;
+
+    static void takeSample();
+    static bool record();
+    static bool upload();
+    static bool uploadDue(uint32_t ahead);
+    static void sleep();
+};
+
+#endif
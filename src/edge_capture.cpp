@@ -0,0 +1,231 @@
+#include "edge_capture.h"
+#include "config.h"
+#include "scheduler.h"
+#include "power_manager.h"
+#include "mqtt_manager.h"
+#include "pipeline.h"
+#include "time_sync.h"
+#include "metrics.h"
+#include "logging.h"
+
+EdgeInput EdgeCapture::_inputs[EDGE_MAX_INPUTS];
+int EdgeCapture::_task = -1;
+PendingEdge EdgeCapture::_pending[EDGE_PENDING_SIZE];
+uint8_t EdgeCapture::_pendingHead = 0;
+uint8_t EdgeCapture::_pendingCount = 0;
+
+// The window is updated by the drain task and read by the sampling side
+#ifdef ESP32
+static portMUX_TYPE edgeMux = portMUX_INITIALIZER_UNLOCKED;
+#define EDGE_LOCK() portENTER_CRITICAL(&edgeMux)
+#define EDGE_UNLOCK() portEXIT_CRITICAL(&edgeMux)
+#else
+#define EDGE_LOCK()
+#define EDGE_UNLOCK()
+#endif
+
+// The ISR and recheck() both feed the ring and the ISR state, so they exclude each other
+#ifdef ESP32
+static portMUX_TYPE isrMux = portMUX_INITIALIZER_UNLOCKED;
+#define EDGE_ISR_ENTER() portENTER_CRITICAL_ISR(&isrMux)
+#define EDGE_ISR_EXIT() portEXIT_CRITICAL_ISR(&isrMux)
+#define EDGE_ISR_LOCK() portENTER_CRITICAL(&isrMux)
+#define EDGE_ISR_UNLOCK() portEXIT_CRITICAL(&isrMux)
+#else
+#define EDGE_ISR_ENTER()
+#define EDGE_ISR_EXIT()
+#define EDGE_ISR_LOCK() noInterrupts()
+#define EDGE_ISR_UNLOCK() interrupts()
+#endif
+
+void EdgeCapture::begin() {
+    // Budget covers one MQTT publish per edge in a burst; the period drives recheck()
+    _task = Scheduler::add("edges", EDGE_RECHECK_MS, 20000, drain);
+    Scheduler::signal(_task); // Anything captured while booting
+}
+
+void IRAM_ATTR EdgeCapture::onEdge(void* arg) {
+    EdgeInput& in = *(EdgeInput*)arg;
+    uint32_t now = micros();
+    uint8_t level = digitalRead(in.pin);
+
+    EDGE_ISR_ENTER();
+    // The pin interrupts on a level, so it is re-armed for the other one every time
+    PowerManager::wakeOnPin(in.pin, !level);
+    // Already back to the accepted level: a glitch shorter than the ISR latency
+    if (level == in.isrLevel) {
+        EDGE_ISR_EXIT();
+        return;
+    }
+    if (now - in.isrLastUs < EDGE_DEBOUNCE_US) {
+        in.bounces++;
+        EDGE_ISR_EXIT();
+        return;
+    }
+    in.isrLevel = level;
+    in.isrLastUs = now;
+    if (!in.ring.push({ now, level })) in.overflows++;
+    EDGE_ISR_EXIT();
+    Scheduler::signalFromIsr(_task);
+}
+
+// Picks up a level the ISR never reported: the last edge of a pulse that ended
+// inside the debounce lockout. Stamped when it is noticed, so at most
+// EDGE_RECHECK_MS late.
+void EdgeCapture::recheck(EdgeInput& in) {
+    EDGE_ISR_LOCK();
+    uint32_t now = micros();
+    uint8_t level = digitalRead(in.pin);
+    PowerManager::wakeOnPin(in.pin, !level);
+    if (level != in.isrLevel && now - in.isrLastUs >= EDGE_DEBOUNCE_US) {
+        in.isrLevel = level;
+        in.isrLastUs = now;
+        if (!in.ring.push({ now, level })) in.overflows++;
+    }
+    EDGE_ISR_UNLOCK();
+}
+
+int EdgeCapture::attach(uint8_t pin, const char* type) {
+    if (digitalPinToInterrupt(pin) == NOT_AN_INTERRUPT) {
+        LOGW(LOG_MOD_SENSOR, "Pin %u has no interrupt, %s is only polled", pin, type);
+        return -1;
+    }
+
+    for (int i = 0; i < EDGE_MAX_INPUTS; i++) {
+        EdgeInput& in = _inputs[i];
+        // A slot is reused only once the drain task has emptied it
+        if (in.active || in.ring.size() > 0) continue;
+
+        uint32_t now = micros();
+        in.pin = pin;
+        strlcpy(in.type, type, sizeof(in.type));
+        in.level = in.isrLevel = digitalRead(pin);
+        in.isrLastUs = now - EDGE_DEBOUNCE_US;
+        in.bounces = 0;
+        in.overflows = 0;
+        in.changedUs = in.windowStartUs = now;
+        in.highUs = 0;
+        in.rises = 0;
+        in.events = 0;
+        in.active = true;
+
+        // GPIO wake turns the interrupt into a level one, armed for the level the
+        // pin is not at; onEdge() flips it, so each edge also ends light sleep
+        attachInterruptArg(pin, onEdge, &in, CHANGE);
+        EDGE_ISR_LOCK();
+        PowerManager::wakeOnPin(pin, !digitalRead(pin));
+        EDGE_ISR_UNLOCK();
+        return i;
+    }
+    LOGW(LOG_MOD_SENSOR, "No edge capture slot for pin %u, %s is only polled", pin, type);
+    return -1;
+}
+
+void EdgeCapture::detach(int input) {
+    if (input < 0 || input >= EDGE_MAX_INPUTS) return;
+    EdgeInput& in = _inputs[input];
+    detachInterrupt(digitalPinToInterrupt(in.pin));
+    PowerManager::clearWakeOnPin(in.pin);
+    in.active = false;
+}
+
+void EdgeCapture::takeWindow(int input, uint32_t& rises, float& highPct, uint8_t& level) {
+    EdgeInput& in = _inputs[input];
+    uint32_t now = micros();
+
+    EDGE_LOCK();
+    uint64_t high = in.highUs + (in.level ? now - in.changedUs : 0);
+    uint32_t span = now - in.windowStartUs;
+    rises = in.rises;
+    level = in.level;
+    in.rises = 0;
+    in.highUs = 0;
+    in.windowStartUs = now;
+    if (in.level) in.changedUs = now;
+    EDGE_UNLOCK();
+
+    highPct = span ? (float)(high * 100.0 / span) : 0;
+}
+
+void EdgeCapture::drain() {
+    for (EdgeInput& in : _inputs) {
+        if (in.active) recheck(in);
+        EdgeEvent e;
+        // With the queue full, edges wait in the input ring rather than being dropped
+        while (_pendingCount < EDGE_PENDING_SIZE && in.ring.pop(e)) {
+            if (!in.active) continue; // Edges left over from a detached driver
+
+            EDGE_LOCK();
+            // An edge from before the window started only sets the level
+            if (in.level && (int32_t)(e.us - in.changedUs) > 0) in.highUs += e.us - in.changedUs;
+            if ((int32_t)(e.us - in.changedUs) > 0) in.changedUs = e.us;
+            in.level = e.level;
+            if (e.level) in.rises++;
+            in.events++;
+            EDGE_UNLOCK();
+
+            metrics.edgeEvents++;
+
+            PendingEdge& p = _pending[(_pendingHead + _pendingCount) % EDGE_PENDING_SIZE];
+            uint64_t nowMs = TimeSync::nowMs();
+            p.ts = nowMs ? nowMs - (micros() - e.us) / 1000 : 0;
+            p.us = e.us;
+            p.events = in.events;
+            p.pin = in.pin;
+            p.level = e.level;
+            p.deferred = false;
+            memcpy(p.type, in.type, sizeof(p.type));
+            _pendingCount++;
+        }
+    }
+    flush();
+}
+
+// Publishes queued edges oldest first and stops at the first failure, so
+// events go out in order once the client is free again
+void EdgeCapture::flush() {
+    while (_pendingCount > 0) {
+        PendingEdge& p = _pending[_pendingHead];
+        if (!publish(p)) {
+            if (!p.deferred) metrics.edgeEventsUnsent++;
+            p.deferred = true;
+            return;
+        }
+        _pendingHead = (_pendingHead + 1) % EDGE_PENDING_SIZE;
+        _pendingCount--;
+    }
+}
+
+bool EdgeCapture::publish(const PendingEdge& p) {
+    JsonDocument doc;
+    doc["sensorId"] = config.sensorId;
+    doc["pin"] = p.pin;
+    doc["type"] = p.type;
+    doc["level"] = p.level;
+    doc["events"] = p.events;
+    if (p.ts) doc["ts"] = p.ts;
+    String payload;
+    serializeJson(doc, payload);
+
+    bool sent;
+    {
+        // The transport task holds the client across reconnects; flush() retries
+        MqttLock lock(EDGE_PUBLISH_WAIT_MS);
+        sent = lock.held() && mqttManager.publishEvent(payload.c_str());
+    }
+    if (sent) metrics.edgePublish.observe(micros() - p.us);
+    return sent;
+}
+
+void EdgeCapture::toJson(JsonArray arr) {
+    for (const EdgeInput& in : _inputs) {
+        if (!in.active) continue;
+        JsonObject o = arr.add<JsonObject>();
+        o["pin"] = in.pin;
+        o["type"] = in.type;
+        o["level"] = in.level;
+        o["events"] = in.events;
+        o["bounces"] = in.bounces;
+        o["overflows"] = in.overflows;
+    }
+}
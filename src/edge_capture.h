@@ -0,0 +1,87 @@
+#ifndef CALID_EDGE_CAPTURE_H
+#define CALID_EDGE_CAPTURE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "spsc_ring.h"
+
+#define EDGE_MAX_INPUTS 4
+#define EDGE_RING_SIZE 32
+#define EDGE_DEBOUNCE_US 20000 // Edges closer than this to the last accepted one are bounces
+#define EDGE_RECHECK_MS 250    // Pin levels are compared with the last reported edge this often
+#define EDGE_PUBLISH_WAIT_MS 5 // Longest the loop waits for the MQTT client per edge
+#define EDGE_PENDING_SIZE 32   // Edges held for republishing while MQTT is busy or down
+
+struct EdgeEvent {
+    uint32_t us;   // micros() in the ISR
+    uint8_t level; // Level after the edge
+};
+
+// An edge waiting to be published, self-contained so its input slot can be reused
+struct PendingEdge {
+    uint64_t ts;   // Wall clock when drained, 0 before time sync
+    uint32_t us;
+    uint32_t events;
+    uint8_t pin;
+    uint8_t level;
+    bool deferred; // Counted in edgeEventsUnsent already
+    char type[8];
+};
+
+struct EdgeInput {
+    volatile bool active;
+    uint8_t pin;
+    char type[8];
+
+    // Written by the ISR only
+    volatile uint8_t isrLevel;
+    volatile uint32_t isrLastUs;
+    volatile uint32_t bounces;
+    volatile uint32_t overflows;
+    SpscRing<EdgeEvent, EDGE_RING_SIZE> ring;
+
+    // Consumer side: level history for the current window
+    uint8_t level;
+    uint32_t changedUs;
+    uint32_t windowStartUs;
+    uint64_t highUs;
+    uint32_t rises;
+    uint32_t events;
+};
+
+// Interrupt-driven capture for digital event inputs (PIR). The ISR debounces in
+// software, stamps each edge with micros() and pushes it into a per-input
+// lock-free ring, then signals a scheduler task that drains the rings and
+// publishes every edge straight away on sensors/<id>/event; edges that cannot be
+// sent yet are queued and retried in order on the next pass. Counts and time
+// spent high are kept per window for the regular telemetry. The same task polls
+// the levels, so an edge the ISR dropped still ends up reported.
+// Each captured pin also wakes the chip from light sleep.
+class EdgeCapture {
+public:
+    static void begin(); // Registers the drain task; edges before this are only counted
+
+    // -1 when the pin cannot interrupt or every input is taken; the caller polls instead
+    static int attach(uint8_t pin, const char* type);
+    static void detach(int input);
+
+    // Rising edges and percent of time high since the previous call
+    static void takeWindow(int input, uint32_t& rises, float& highPct, uint8_t& level);
+
+    static void toJson(JsonArray arr);
+
+private:
+    static EdgeInput _inputs[EDGE_MAX_INPUTS];
+    static int _task;
+    static PendingEdge _pending[EDGE_PENDING_SIZE];
+    static uint8_t _pendingHead;
+    static uint8_t _pendingCount;
+
+    static void onEdge(void* arg);
+    static void recheck(EdgeInput& in);
+    static void drain();
+    static void flush();
+    static bool publish(const PendingEdge& p);
+};
+
+#endif
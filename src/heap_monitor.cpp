@@ -0,0 +1,183 @@
+#include "heap_monitor.h"
+#include "config.h"
+#include "mqtt_manager.h"
+#include "logging.h"
+#if defined(ESP32)
+#include <esp_heap_caps.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#endif
+
+AllocStats allocStats;
+
+uint32_t HeapMonitor::_minFree = UINT32_MAX;
+uint32_t HeapMonitor::_minBlock = UINT32_MAX;
+bool HeapMonitor::_atRisk = false;
+
+#ifdef CALID_ALLOC_HOOK
+extern "C" {
+void* __real_malloc(size_t size);
+void __real_free(void* ptr);
+void* __real_realloc(void* ptr, size_t size);
+void* __real_calloc(size_t n, size_t size);
+
+static void* counted(void* p, size_t size) {
+    if (p) {
+        allocStats.allocs.fetch_add(1, std::memory_order_relaxed);
+    } else if (size) {
+        allocStats.failures.fetch_add(1, std::memory_order_relaxed);
+        allocStats.lastFailedSize.store(size, std::memory_order_relaxed);
+    }
+    return p;
+}
+
+void* __wrap_malloc(size_t size) { return counted(__real_malloc(size), size); }
+void* __wrap_calloc(size_t n, size_t size) { return counted(__real_calloc(n, size), n * size); }
+
+void* __wrap_realloc(void* ptr, size_t size) {
+    void* p = __real_realloc(ptr, size);
+    // Growing in place or moving is still one live block
+    if (!p && size) {
+        allocStats.failures.fetch_add(1, std::memory_order_relaxed);
+        allocStats.lastFailedSize.store(size, std::memory_order_relaxed);
+    } else if (!ptr && p) {
+        allocStats.allocs.fetch_add(1, std::memory_order_relaxed);
+    }
+    return p;
+}
+
+void __wrap_free(void* ptr) {
+    if (ptr) allocStats.frees.fetch_add(1, std::memory_order_relaxed);
+    __real_free(ptr);
+}
+}
+#endif
+
+#if defined(ESP32) && !defined(CALID_ALLOC_HOOK)
+// Runs in the failing caller's context: no logging or allocation here
+static void onAllocFailed(size_t size, uint32_t caps, const char* function) {
+    allocStats.failures.fetch_add(1, std::memory_order_relaxed);
+    allocStats.lastFailedSize.store(size, std::memory_order_relaxed);
+}
+#endif
+
+void HeapMonitor::begin() {
+    #if defined(ESP32) && !defined(CALID_ALLOC_HOOK)
+    heap_caps_register_failed_alloc_callback(onAllocFailed);
+    #endif
+    sample();
+}
+
+uint32_t HeapMonitor::freeHeap() {
+    return ESP.getFreeHeap();
+}
+
+uint32_t HeapMonitor::largestBlock() {
+    #ifdef ESP32
+    return heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    #else
+    return ESP.getMaxFreeBlockSize();
+    #endif
+}
+
+uint8_t HeapMonitor::fragmentation() {
+    #ifdef ESP32
+    uint32_t total = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    uint32_t largest = largestBlock();
+    if (!total || largest >= total) return 0;
+    return 100 - (uint8_t)((uint64_t)largest * 100 / total);
+    #else
+    return ESP.getHeapFragmentation();
+    #endif
+}
+
+void HeapMonitor::sample() {
+    uint32_t freeBytes = freeHeap();
+    uint32_t block = largestBlock();
+    #ifdef ESP32
+    // The allocator tracks its own floor, which catches dips between samples
+    uint32_t floor = ESP.getMinFreeHeap();
+    if (floor < _minFree) _minFree = floor;
+    #endif
+    if (freeBytes < _minFree) _minFree = freeBytes;
+    if (block < _minBlock) _minBlock = block;
+
+    bool atRisk = tlsAtRisk();
+    if (atRisk != _atRisk) {
+        _atRisk = atRisk;
+        if (atRisk) {
+            LOGW(LOG_MOD_SYSTEM, "Heap too fragmented for TLS: %u free, largest block %u", (unsigned)freeBytes, (unsigned)block);
+        } else {
+            LOGI(LOG_MOD_SYSTEM, "Heap has room for TLS again");
+        }
+    }
+}
+
+bool HeapMonitor::tlsInUse() {
+    return (config.mqttEnabled && config.mqttPort == 8883) ||
+           strncmp(config.apiEndpoint, "https://", 8) == 0;
+}
+
+bool HeapMonitor::tlsAtRisk() {
+    // An open MQTT TLS session already holds its buffers; only a new session needs room
+    bool needsSession = strncmp(config.apiEndpoint, "https://", 8) == 0 ||
+        (config.mqttEnabled && config.mqttPort == 8883 && !mqttManager.isConnected());
+    if (!needsSession) return false;
+    return largestBlock() < HEAP_TLS_MIN_BLOCK || freeHeap() < HEAP_TLS_MIN_FREE;
+}
+
+#ifdef ESP32
+// Tasks that are ours or that we depend on; missing ones are skipped
+static const char* const watchedTasks[] = { "loopTask", "async_tcp", "acquire", "process", "transport" };
+#endif
+
+uint32_t HeapMonitor::minStackFree(const char** task) {
+    #ifdef ESP32
+    uint32_t least = UINT32_MAX;
+    for (const char* name : watchedTasks) {
+        TaskHandle_t handle = xTaskGetHandle(name);
+        if (!handle) continue;
+        uint32_t headroom = uxTaskGetStackHighWaterMark(handle);
+        if (headroom < least) {
+            least = headroom;
+            if (task) *task = name;
+        }
+    }
+    return least == UINT32_MAX ? 0 : least;
+    #else
+    if (task) *task = "cont";
+    return ESP.getFreeContStack();
+    #endif
+}
+
+void HeapMonitor::toJson(JsonObject obj) {
+    obj["free"] = freeHeap();
+    obj["largestBlock"] = largestBlock();
+    obj["fragmentation"] = fragmentation();
+    obj["minFree"] = _minFree;
+    obj["minLargestBlock"] = _minBlock;
+    obj["tlsInUse"] = tlsInUse();
+    obj["tlsAtRisk"] = tlsAtRisk();
+
+    #ifdef CALID_ALLOC_HOOK
+    obj["allocs"] = allocStats.allocs.load(std::memory_order_relaxed);
+    obj["frees"] = allocStats.frees.load(std::memory_order_relaxed);
+    #endif
+    obj["allocFailures"] = allocStats.failures.load(std::memory_order_relaxed);
+    obj["lastFailedSize"] = allocStats.lastFailedSize.load(std::memory_order_relaxed);
+
+    JsonArray stacks = obj["stacks"].to<JsonArray>();
+    #ifdef ESP32
+    for (const char* name : watchedTasks) {
+        TaskHandle_t handle = xTaskGetHandle(name);
+        if (!handle) continue;
+        JsonObject s = stacks.add<JsonObject>();
+        s["task"] = name;
+        s["free"] = uxTaskGetStackHighWaterMark(handle);
+    }
+    #else
+    JsonObject s = stacks.add<JsonObject>();
+    s["task"] = "cont";
+    s["free"] = ESP.getFreeContStack();
+    #endif
+}
@@ -0,0 +1,58 @@
+#ifndef CALID_HEAP_MONITOR_H
+#define CALID_HEAP_MONITOR_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <atomic>
+
+#define HEAP_SAMPLE_INTERVAL_MS 1000
+
+// Contiguous memory a TLS session needs up front: the 16 KB record buffer plus
+// the rest of the handshake state (BearSSL on ESP8266, mbedTLS on ESP32)
+#if defined(ESP8266)
+#define HEAP_TLS_MIN_BLOCK 17408
+#define HEAP_TLS_MIN_FREE 24576
+#else
+#define HEAP_TLS_MIN_BLOCK 17408
+#define HEAP_TLS_MIN_FREE 40960
+#endif
+
+// Build with -D CALID_ALLOC_HOOK and
+//   -Wl,--wrap=malloc -Wl,--wrap=free -Wl,--wrap=realloc -Wl,--wrap=calloc
+// to count every allocation. Without it only failures are counted (ESP32).
+struct AllocStats {
+    std::atomic<uint32_t> allocs{0};
+    std::atomic<uint32_t> frees{0};
+    std::atomic<uint32_t> failures{0};
+    std::atomic<uint32_t> lastFailedSize{0};
+};
+
+extern AllocStats allocStats;
+
+// Heap shape rather than just the free total: a sensor gateway that has plenty
+// of free bytes can still fail a TLS handshake once the heap is fragmented.
+class HeapMonitor {
+public:
+    static void begin();
+    static void sample(); // Updates the low-water marks; cheap, run it often
+
+    static uint32_t freeHeap();
+    static uint32_t largestBlock();
+    static uint8_t fragmentation(); // 0-100, share of free memory outside the largest block
+    static uint32_t minFreeHeap() { return _minFree; }
+    static uint32_t minLargestBlock() { return _minBlock; }
+    static bool tlsInUse();
+    static bool tlsAtRisk(); // The next TLS session will probably not fit
+
+    // Smallest stack headroom across the tasks we know about, in bytes
+    static uint32_t minStackFree(const char** task = nullptr);
+
+    static void toJson(JsonObject obj);
+
+private:
+    static uint32_t _minFree;
+    static uint32_t _minBlock;
+    static bool _atRisk;
+};
+
+#endif
@@ -0,0 +1,322 @@
+#include "history_store.h"
+#include "logging.h"
+#include "trace.h"
+
+#define HISTORY_MAGIC 0x43485332 // "CHS2"
+#define HISTORY_MAGIC_V1 0x43485331 // Fixed 2048/2048/1024 record rings
+
+HistoryStore historyStore;
+
+struct HistoryHeader {
+    uint32_t magic;
+    uint32_t head;  // Next slot to write
+    uint32_t count; // Valid records, saturates at capacity
+};
+
+static bool readHeader(File& f, HistoryHeader& h) {
+    f.seek(0);
+    return f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && h.magic == HISTORY_MAGIC;
+}
+
+static size_t recordOffset(uint32_t slot) {
+    return sizeof(HistoryHeader) + (size_t)slot * sizeof(HistoryRecord);
+}
+
+// ---- HistoryStore ----
+
+HistoryStore::HistoryStore() : _ready(false) {
+    memset(_minute, 0, sizeof(_minute));
+    memset(_hour, 0, sizeof(_hour));
+}
+
+const char* HistoryStore::tierPath(HistoryTier tier) {
+    switch (tier) {
+        case HISTORY_MINUTE: return HISTORY_DIR "/1m.bin";
+        case HISTORY_HOUR: return HISTORY_DIR "/1h.bin";
+        default: return HISTORY_DIR "/raw.bin";
+    }
+}
+
+uint32_t HistoryStore::tierSeconds(HistoryTier tier) {
+    switch (tier) {
+        case HISTORY_MINUTE: return 60;
+        case HISTORY_HOUR: return 3600;
+        default: return 1;
+    }
+}
+
+uint32_t HistoryStore::tierCapacity(HistoryTier tier) {
+    // 24 B/record: raw ~48 KB, minute ~203 KB, hour ~47 KB
+    switch (tier) {
+        case HISTORY_MINUTE: return HISTORY_MINUTE_SPAN_S / 60 * HISTORY_SIZED_CHANNELS;
+        case HISTORY_HOUR: return HISTORY_HOUR_SPAN_S / 3600 * HISTORY_SIZED_CHANNELS;
+        default: return HISTORY_RAW_RECORDS;
+    }
+}
+
+uint32_t HistoryStore::oldestTime(HistoryTier tier) {
+    File f = LittleFS.open(tierPath(tier), "r");
+    if (!f) return 0;
+    HistoryHeader h;
+    HistoryRecord rec;
+    uint32_t time = 0;
+    if (readHeader(f, h) && h.count > 0) {
+        uint32_t oldest = h.count < tierCapacity(tier) ? 0 : h.head;
+        f.seek(recordOffset(oldest));
+        if (f.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec)) time = rec.time;
+    }
+    f.close();
+    return time;
+}
+
+HistoryTier HistoryStore::tierFor(uint32_t step, uint32_t from) {
+    int tier = step >= 3600 ? HISTORY_HOUR : step >= 60 ? HISTORY_MINUTE : HISTORY_RAW;
+    if (from == 0) return (HistoryTier)tier;
+    // A tier whose oldest record is after `from` would silently cut the range short
+    while (tier < HISTORY_HOUR) {
+        uint32_t oldest = oldestTime((HistoryTier)tier);
+        if (oldest && oldest <= from) break;
+        tier++;
+    }
+    return (HistoryTier)tier;
+}
+
+String HistoryStore::channelKey(int pin, const Reading& r) {
+    String key = String(pin) + "/" + r.type;
+    if (r.device.length()) key += "/" + r.device;
+    return key;
+}
+
+uint32_t HistoryStore::channelId(const String& key) {
+    // FNV-1a
+    uint32_t h = 2166136261UL;
+    for (size_t i = 0; i < key.length(); i++) {
+        h ^= (uint8_t)key[i];
+        h *= 16777619UL;
+    }
+    return h;
+}
+
+void HistoryStore::begin() {
+    if (!LittleFS.exists(HISTORY_DIR)) {
+        LittleFS.mkdir(HISTORY_DIR);
+    }
+
+    for (int t = 0; t < HISTORY_TIER_COUNT; t++) {
+        const char* path = tierPath((HistoryTier)t);
+        HistoryHeader h;
+        bool valid = false;
+        if (LittleFS.exists(path)) {
+            File f = LittleFS.open(path, "r");
+            valid = f && readHeader(f, h);
+            bool legacy = !valid && f && f.seek(0) && f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) && h.magic == HISTORY_MAGIC_V1;
+            if (f) f.close();
+            if (legacy) {
+                static const uint32_t legacyCapacity[HISTORY_TIER_COUNT] = { 2048, 2048, 1024 };
+                valid = migrate(path, legacyCapacity[t]);
+            }
+        }
+        if (!valid) {
+            File f = LittleFS.open(path, "w");
+            if (!f) {
+                LOGE(LOG_MOD_SYSTEM, "History: failed to create %s", path);
+                return;
+            }
+            h = { HISTORY_MAGIC, 0, 0 };
+            f.write((const uint8_t*)&h, sizeof(h));
+            f.close();
+        }
+    }
+    _ready = true;
+}
+
+// Rewrites a ring from the fixed-size layout oldest first, so it can keep
+// growing into its new capacity
+bool HistoryStore::migrate(const char* path, uint32_t legacyCapacity) {
+    String tmp = String(path) + ".tmp";
+    File in = LittleFS.open(path, "r");
+    File out = LittleFS.open(tmp, "w");
+    if (!in || !out) {
+        if (in) in.close();
+        if (out) out.close();
+        return false;
+    }
+
+    HistoryHeader h;
+    in.read((uint8_t*)&h, sizeof(h));
+    uint32_t count = h.count < legacyCapacity ? h.count : legacyCapacity;
+    uint32_t oldest = h.count < legacyCapacity ? 0 : h.head;
+    HistoryHeader next = { HISTORY_MAGIC, count, count };
+    out.write((const uint8_t*)&next, sizeof(next));
+
+    HistoryRecord rec;
+    for (uint32_t i = 0; i < count; i++) {
+        in.seek(recordOffset((oldest + i) % legacyCapacity));
+        if (in.read((uint8_t*)&rec, sizeof(rec)) != sizeof(rec)) break;
+        out.write((const uint8_t*)&rec, sizeof(rec));
+    }
+    in.close();
+    out.close();
+
+    LittleFS.remove(path);
+    bool ok = LittleFS.rename(tmp, path);
+    LOGI(LOG_MOD_SYSTEM, "History: migrated %u records in %s", (unsigned)count, path);
+    return ok;
+}
+
+bool HistoryStore::writeRecord(HistoryTier tier, const HistoryRecord& rec) {
+    File f = LittleFS.open(tierPath(tier), "r+");
+    if (!f) return false;
+
+    HistoryHeader h;
+    if (!readHeader(f, h)) {
+        f.close();
+        return false;
+    }
+
+    uint32_t cap = tierCapacity(tier);
+    f.seek(recordOffset(h.head));
+    f.write((const uint8_t*)&rec, sizeof(rec));
+
+    h.head = (h.head + 1) % cap;
+    if (h.count < cap) h.count++;
+    f.seek(0);
+    f.write((const uint8_t*)&h, sizeof(h));
+    f.close();
+    return true;
+}
+
+void HistoryStore::accumulate(Rollup* table, HistoryTier tier, uint32_t bucketSeconds, uint32_t channel, uint32_t epoch, float value) {
+    uint32_t start = epoch - (epoch % bucketSeconds);
+
+    Rollup* slot = nullptr;
+    Rollup* freeSlot = nullptr;
+    for (int i = 0; i < HISTORY_MAX_CHANNELS; i++) {
+        if (table[i].count && table[i].channel == channel) { slot = &table[i]; break; }
+        if (!table[i].count && !freeSlot) freeSlot = &table[i];
+    }
+
+    if (slot && slot->start != start) {
+        HistoryRecord rec = { slot->start, channel, slot->sum / slot->count, slot->min, slot->max, slot->count, 0 };
+        writeRecord(tier, rec);
+        slot->count = 0;
+    }
+    if (!slot) slot = freeSlot;
+    if (!slot) return; // More channels than rollup slots: raw tier only
+
+    if (!slot->count) {
+        slot->channel = channel;
+        slot->start = start;
+        slot->sum = 0;
+        slot->min = value;
+        slot->max = value;
+    }
+    slot->sum += value;
+    if (value < slot->min) slot->min = value;
+    if (value > slot->max) slot->max = value;
+    slot->count++;
+}
+
+void HistoryStore::append(const SensorReadings* data, int count) {
+    if (!_ready) return;
+    TRACE_SCOPE("history.append", "flash");
+
+    for (int i = 0; i < count; i++) {
+        if (!data[i].valid || !data[i].fresh || data[i].timestampMs == 0) continue;
+        uint32_t epoch = data[i].timestampMs / 1000;
+        for (const auto& r : data[i].readings) {
+            if (isnan(r.value)) continue;
+            uint32_t channel = channelId(channelKey(data[i].pin, r));
+
+            HistoryRecord rec = { epoch, channel, r.value, r.value, r.value, 1, 0 };
+            writeRecord(HISTORY_RAW, rec);
+            accumulate(_minute, HISTORY_MINUTE, 60, channel, epoch, r.value);
+            accumulate(_hour, HISTORY_HOUR, 3600, channel, epoch, r.value);
+        }
+    }
+}
+
+// ---- HistoryCursor ----
+
+HistoryCursor::HistoryCursor(HistoryTier tier, uint32_t channel, uint32_t from, uint32_t to, uint32_t step)
+    : _capacity(HistoryStore::tierCapacity(tier)), _oldest(0), _index(0), _count(0),
+      _channel(channel), _to(to), _step(step ? step : 1), _hasBucket(false),
+      _bucketStart(0), _sum(0), _min(0), _max(0), _samples(0) {
+    _file = LittleFS.open(HistoryStore::tierPath(tier), "r");
+    if (!_file) return;
+
+    HistoryHeader h;
+    if (!readHeader(_file, h)) {
+        _file.close();
+        return;
+    }
+    _count = h.count;
+    _oldest = (h.count < _capacity) ? 0 : h.head;
+    _index = lowerBound(from);
+}
+
+HistoryCursor::~HistoryCursor() {
+    if (_file) _file.close();
+}
+
+bool HistoryCursor::readAt(uint32_t logical, HistoryRecord& rec) {
+    uint32_t slot = (_oldest + logical) % _capacity;
+    _file.seek(recordOffset(slot));
+    return _file.read((uint8_t*)&rec, sizeof(rec)) == sizeof(rec);
+}
+
+// Records are appended in time order, so the ring can be bisected
+uint32_t HistoryCursor::lowerBound(uint32_t from) {
+    uint32_t lo = 0, hi = _count;
+    HistoryRecord rec;
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (!readAt(mid, rec)) return _count;
+        if (rec.time < from) lo = mid + 1;
+        else hi = mid;
+    }
+    return lo;
+}
+
+bool HistoryCursor::next(HistoryPoint& out) {
+    if (!_file) return false;
+
+    HistoryRecord rec;
+    while (_index < _count) {
+        if (!readAt(_index, rec)) break;
+        if (rec.time > _to) break;
+        _index++;
+        if (rec.channel != _channel || !rec.count) continue;
+
+        uint32_t bucket = rec.time - (rec.time % _step);
+        if (_hasBucket && bucket != _bucketStart) {
+            out = { _bucketStart, _sum / _samples, _min, _max };
+            _bucketStart = bucket;
+            _sum = rec.avg * rec.count;
+            _min = rec.min;
+            _max = rec.max;
+            _samples = rec.count;
+            return true;
+        }
+        if (!_hasBucket) {
+            _hasBucket = true;
+            _bucketStart = bucket;
+            _sum = 0;
+            _min = rec.min;
+            _max = rec.max;
+            _samples = 0;
+        }
+        _sum += rec.avg * rec.count;
+        if (rec.min < _min) _min = rec.min;
+        if (rec.max > _max) _max = rec.max;
+        _samples += rec.count;
+    }
+
+    _index = _count;
+    if (_hasBucket) {
+        out = { _bucketStart, _sum / _samples, _min, _max };
+        _hasBucket = false;
+        return true;
+    }
+    return false;
+}
@@ -0,0 +1,114 @@
+#ifndef CALID_HISTORY_STORE_H
+#define CALID_HISTORY_STORE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "../include/SensorInterface.h"
+
+#define HISTORY_DIR "/hist"
+#define HISTORY_MAX_CHANNELS 16
+
+// Each rollup tier is sized to hold its span for HISTORY_SIZED_CHANNELS channels;
+// more channels shorten every span in proportion. Raw keeps the latest samples,
+// which at adaptive rates can be anything from minutes to hours.
+#define HISTORY_SIZED_CHANNELS 6
+#define HISTORY_RAW_RECORDS 2048
+#define HISTORY_MINUTE_SPAN_S 86400UL        // A day of minute buckets
+#define HISTORY_HOUR_SPAN_S (14 * 86400UL)   // Two weeks of hour buckets
+
+enum HistoryTier {
+    HISTORY_RAW = 0,
+    HISTORY_MINUTE,
+    HISTORY_HOUR,
+    HISTORY_TIER_COUNT
+};
+
+// Fixed-width on-flash record. Raw samples use avg == min == max, count == 1.
+struct HistoryRecord {
+    uint32_t time;    // Epoch seconds (UTC), bucket start for rollups
+    uint32_t channel; // Hash of the channel key
+    float avg;
+    float min;
+    float max;
+    uint16_t count;
+    uint16_t reserved;
+};
+
+struct HistoryPoint {
+    uint32_t time;
+    float avg;
+    float min;
+    float max;
+};
+
+// Forward-only reader over one tier, downsampling matches into `step` second buckets.
+// Holds a single record in RAM regardless of the queried range.
+class HistoryCursor {
+public:
+    HistoryCursor(HistoryTier tier, uint32_t channel, uint32_t from, uint32_t to, uint32_t step);
+    ~HistoryCursor();
+    bool next(HistoryPoint& out);
+
+private:
+    File _file;
+    uint32_t _capacity;
+    uint32_t _oldest;
+    uint32_t _index;
+    uint32_t _count;
+    uint32_t _channel;
+    uint32_t _to;
+    uint32_t _step;
+
+    bool _hasBucket;
+    uint32_t _bucketStart;
+    float _sum;
+    float _min;
+    float _max;
+    uint32_t _samples;
+
+    bool readAt(uint32_t logical, HistoryRecord& rec);
+    uint32_t lowerBound(uint32_t from);
+};
+
+class HistoryStore {
+public:
+    HistoryStore();
+    void begin();
+
+    // Appends readings at their own timestamps and rolls them into the minute/hour tiers;
+    // unstamped ones are skipped
+    void append(const SensorReadings* data, int count);
+
+    // Channels are keyed "<pin>/<type>" or "<pin>/<type>/<device>"
+    static String channelKey(int pin, const Reading& r);
+    static uint32_t channelId(const String& key);
+    // Finest tier for `step` that still reaches back to `from` (0: no lower bound),
+    // otherwise the next coarser one
+    static HistoryTier tierFor(uint32_t step, uint32_t from);
+    static uint32_t tierSeconds(HistoryTier tier);
+    static const char* tierPath(HistoryTier tier);
+    static uint32_t tierCapacity(HistoryTier tier);
+    static uint32_t oldestTime(HistoryTier tier); // 0 when the tier is empty
+
+private:
+    struct Rollup {
+        uint32_t channel;
+        uint32_t start;
+        float sum;
+        float min;
+        float max;
+        uint16_t count;
+    };
+
+    Rollup _minute[HISTORY_MAX_CHANNELS];
+    Rollup _hour[HISTORY_MAX_CHANNELS];
+    bool _ready;
+
+    bool migrate(const char* path, uint32_t legacyCapacity);
+    void accumulate(Rollup* table, HistoryTier tier, uint32_t bucketSeconds, uint32_t channel, uint32_t epoch, float value);
+    bool writeRecord(HistoryTier tier, const HistoryRecord& rec);
+};
+
+extern HistoryStore historyStore;
+
+#endif
@@ -1,63 +1,349 @@
 #include "logging.h"
+#include "trace.h"
 
-Logger::Logger(const char* logFileName) : logFileName(logFileName) {}
+#ifdef ESP32
+#define LOG_LOCK() portENTER_CRITICAL(&_mux)
+#define LOG_UNLOCK() portEXIT_CRITICAL(&_mux)
+#else
+#define LOG_LOCK()
+#define LOG_UNLOCK()
+#endif
 
+static const char LEVEL_CHARS[] = { 'D', 'I', 'W', 'E' };
+static const char* const LEVEL_NAMES[] = { "debug", "info", "warn", "error", "none" };
+static const char* const MODULE_NAMES[LOG_MOD_COUNT] = { "system", "config", "wifi", "mqtt", "web", "sensor", "ota" };
+
+Logger::Logger(const char* logDir)
+    : logDir(logDir), _head(0), _tail(0), _echoed(0), _dropped(0), _reportedDropped(0), _oldestPending(0),
+      _firstSeg(0), _curSeg(0), _segmentBytes(0), _maxSegments(LOG_DEFAULT_BUDGET / LOG_SEGMENT_SIZE) {
+    for (int i = 0; i < LOG_MOD_COUNT; i++) _levels[i] = LOG_INFO;
+}
+
+const char* Logger::moduleName(LogModule module) {
+    return module < LOG_MOD_COUNT ? MODULE_NAMES[module] : "?";
+}
+
+// Replaces the current filter; modules not named in the spec fall back to info
+bool Logger::applyLevelSpec(const char* spec) {
+    for (int i = 0; i < LOG_MOD_COUNT; i++) _levels[i] = LOG_INFO;
+
+    bool ok = true;
+    String s(spec);
+    int start = 0;
+    while (start < (int)s.length()) {
+        int end = s.indexOf(',', start);
+        if (end < 0) end = s.length();
+        String item = s.substring(start, end);
+        start = end + 1;
+        item.trim();
+        if (item.length() == 0) continue;
+
+        int eq = item.indexOf('=');
+        String mod = eq < 0 ? String("*") : item.substring(0, eq);
+        String lvl = eq < 0 ? item : item.substring(eq + 1);
+        mod.trim();
+        lvl.trim();
+
+        int level = -1;
+        for (int l = 0; l <= LOG_LEVEL_NONE; l++) {
+            if (lvl.equalsIgnoreCase(LEVEL_NAMES[l])) level = l;
+        }
+        if (level < 0) { ok = false; continue; }
+
+        bool matched = false;
+        for (int m = 0; m < LOG_MOD_COUNT; m++) {
+            if (mod == "*" || mod.equalsIgnoreCase(MODULE_NAMES[m])) {
+                _levels[m] = (LogLevel)level;
+                matched = true;
+            }
+        }
+        if (!matched) ok = false;
+    }
+    return ok;
+}
+
+// Expects LittleFS to be mounted already by setup()
 void Logger::begin() {
+    if (!LittleFS.exists(logDir)) {
+        LittleFS.mkdir(logDir);
+    }
+
+    scanSegments();
+    #ifndef CALID_LOG_BINARY
+    // Pre-segmentation single-file log becomes the first segment, so upgrades keep
+    // field logs; rotation drops it like any other once the budget is reached
+    if (_segmentBytes == 0 && _curSeg == 0 && LittleFS.exists("/log.txt")) {
+        if (LittleFS.rename("/log.txt", segmentPath(0))) {
+            scanSegments();
+        }
+    }
+    #endif
+    if (_segmentBytes == 0) {
+        File file = LittleFS.open(segmentPath(_curSeg), "a");
+        if (!file) {
+            Serial.println("Failed to create log file");
+            return;
+        }
+        #ifndef CALID_LOG_BINARY
+        _segmentBytes += file.println("Started logging");
+        #endif
+        file.close();
+    }
+}
+
+String Logger::segmentPath(uint32_t seq) const {
+    return logDir + "/log." + String(seq);
+}
+
+void Logger::scanSegments() {
+    bool found = false;
+    uint32_t lo = 0, hi = 0;
+
     #ifdef ESP32
-    if (!LittleFS.begin(true)) {
+    File dir = LittleFS.open(logDir);
+    File f = dir.openNextFile();
+    while (f) {
+        String name = f.name();
+        name = name.substring(name.lastIndexOf('/') + 1);
     #else
-    if (!LittleFS.begin()) {
+    Dir dir = LittleFS.openDir(logDir);
+    while (dir.next()) {
+        String name = dir.fileName();
     #endif
-        Serial.println("Failed to mount file system");
-        return;
+        if (name.startsWith("log.")) {
+            uint32_t seq = strtoul(name.c_str() + 4, NULL, 10);
+            if (!found || seq < lo) lo = seq;
+            if (!found || seq > hi) hi = seq;
+            found = true;
+        }
+    #ifdef ESP32
+        f = dir.openNextFile();
     }
-    File file = LittleFS.open(logFileName, "r");
-    if (!file) {
-      file = LittleFS.open(logFileName, "w");
-      if (!file) {
-        Serial.println("Failed to create log file");
-        return;
-      }
-      file.println("Started logging");
-      file.close();
+    #else
+    }
+    #endif
+
+    _firstSeg = found ? lo : 0;
+    _curSeg = found ? hi : 0;
+    _segmentBytes = 0;
+    if (found) {
+        File cur = LittleFS.open(segmentPath(_curSeg), "r");
+        if (cur) {
+            _segmentBytes = cur.size();
+            cur.close();
+        }
     }
 }
 
-void Logger::log(const String& message) {
-    appendToFile(message);
+uint32_t Logger::clampBudget(int64_t bytes) {
+    #ifdef ESP8266
+    FSInfo info;
+    uint64_t total = LittleFS.info(info) ? info.totalBytes : 0;
+    #else
+    uint64_t total = LittleFS.totalBytes();
+    #endif
+    int64_t lo = (int64_t)LOG_MIN_SEGMENTS * LOG_SEGMENT_SIZE;
+    int64_t hi = (int64_t)(total / LOG_MAX_FS_SHARE);
+    if (hi < lo) hi = lo;
+    return (uint32_t)(bytes < lo ? lo : bytes > hi ? hi : bytes);
 }
 
-void Logger::appendToFile(const String& message) {
-    // Basic rotation: if file > 50KB, clear it
-    File checkFile = LittleFS.open(logFileName, "r");
-    if (checkFile && checkFile.size() > 51200) {
-        checkFile.close();
-        File clearFile = LittleFS.open(logFileName, "w");
-        if (clearFile) {
-            clearFile.println("--- Log Rotated ---");
-            clearFile.close();
-        }
-    } else if (checkFile) {
-        checkFile.close();
+void Logger::setBudget(uint32_t bytes) {
+    _maxSegments = clampBudget(bytes) / LOG_SEGMENT_SIZE;
+}
+
+// Starts a new segment and drops whole old ones until we are back under budget
+void Logger::rotate() {
+    _curSeg++;
+    _segmentBytes = 0;
+    while (_curSeg - _firstSeg + 1 > _maxSegments) {
+        LittleFS.remove(segmentPath(_firstSeg));
+        _firstSeg++;
     }
+}
 
-    File file = LittleFS.open(logFileName, "a");
-    if (!file) {
-        Serial.println("Failed to open log file");
+size_t Logger::pending() const {
+    size_t head = _head, tail = _tail;
+    return (head + LOG_BUFFER_SIZE - tail) % LOG_BUFFER_SIZE;
+}
+
+void Logger::logf(LogModule module, LogLevel level, const char* fmt, ...) {
+    // Only reached when the level is enabled, so formatting is paid for emitted records only
+    char buf[LOG_LINE_MAX];
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    if (n < 0) return;
+    if (n >= (int)sizeof(buf)) n = sizeof(buf) - 1;
+    write(module, level, buf, n);
+}
+
+void Logger::log(const String& message, LogLevel level) {
+    if (!enabled(LOG_MOD_SYSTEM, level)) return;
+    write(LOG_MOD_SYSTEM, level, message.c_str(), message.length());
+}
+
+void Logger::write(LogModule module, LogLevel level, const char* message, size_t len) {
+    if (len > 0xFFFF) len = 0xFFFF;
+    LogRecord rec = { (uint32_t)millis(), (uint8_t)level, (uint8_t)module, (uint16_t)len };
+
+    LOG_LOCK();
+    // One byte is kept free to tell a full ring from an empty one
+    size_t needed = sizeof(rec) + len;
+    if (needed > LOG_BUFFER_SIZE - 1 - pending()) {
+        LOG_UNLOCK();
+        _dropped++;
         return;
     }
-    file.println(message);
-    file.close();
+    if (pending() == 0) _oldestPending = millis();
+    enqueue(&rec, sizeof(rec));
+    enqueue(message, len);
+    LOG_UNLOCK();
 }
 
-void Logger::printLogs() {
-    File file = LittleFS.open(logFileName, "r");
+void Logger::enqueue(const void* data, size_t len) {
+    const uint8_t* src = (const uint8_t*)data;
+    size_t head = _head;
+    size_t first = LOG_BUFFER_SIZE - head;
+    if (first > len) first = len;
+    memcpy(_ring + head, src, first);
+    memcpy(_ring, src + first, len - first);
+    _head = (head + len) % LOG_BUFFER_SIZE;
+}
+
+void Logger::peek(size_t pos, void* out, size_t len) const {
+    uint8_t* dst = (uint8_t*)out;
+    size_t first = LOG_BUFFER_SIZE - pos;
+    if (first > len) first = len;
+    memcpy(dst, _ring + pos, first);
+    memcpy(dst + first, _ring, len - first);
+}
+
+// Formats the record at `pos` as one text line, returning its length; `pos` moves past it
+size_t Logger::formatRecord(size_t& pos, char* line, size_t size) const {
+    LogRecord rec;
+    peek(pos, &rec, sizeof(rec));
+    pos = (pos + sizeof(rec)) % LOG_BUFFER_SIZE;
+
+    int n = snprintf(line, size, "[%lu] %c %s: ", (unsigned long)rec.millis,
+                     LEVEL_CHARS[rec.level & 3], moduleName((LogModule)rec.module));
+    size_t msgLen = rec.length;
+    size_t room = size - n - 1;
+    size_t copy = msgLen < room ? msgLen : room;
+    peek(pos, line + n, copy);
+    pos = (pos + msgLen) % LOG_BUFFER_SIZE;
+    line[n + copy] = '\n';
+    return n + copy + 1;
+}
+
+// Writes the records in [tail, head) to `file`, returning the bytes written
+size_t Logger::writeRecords(File& file, size_t tail, size_t head) {
+    size_t written = 0;
+
+    #ifdef CALID_LOG_BINARY
+    if (head >= tail) {
+        written += file.write(_ring + tail, head - tail);
+    } else {
+        written += file.write(_ring + tail, LOG_BUFFER_SIZE - tail);
+        written += file.write(_ring, head);
+    }
+    #else
+    char line[LOG_LINE_MAX + 32];
+    size_t pos = tail;
+    while (pos != head) {
+        size_t n = formatRecord(pos, line, sizeof(line));
+        written += file.write((const uint8_t*)line, n);
+    }
+    #endif
+
+    return written;
+}
+
+// Prints records from _echoed up to `head`. Only called with _flushing held, so the
+// span cannot be released under it. Stops early once the UART buffer is full.
+void Logger::echo(size_t head, size_t maxRecords) {
+    char line[LOG_LINE_MAX + 32];
+    size_t pos = _echoed;
+    for (size_t i = 0; pos != head && i < maxRecords; i++) {
+        size_t next = pos;
+        size_t n = formatRecord(next, line, sizeof(line));
+        if (maxRecords != SIZE_MAX && (size_t)Serial.availableForWrite() < n) break;
+        Serial.write((const uint8_t*)line, n);
+        pos = next;
+    }
+    _echoed = pos;
+}
+
+void Logger::loop() {
+    if (!_flushing.test_and_set()) {
+        echo(_head, LOG_ECHO_RECORDS);
+        _flushing.clear();
+    }
+
+    size_t bytes = pending();
+    if (bytes == 0) return;
+    if (bytes >= LOG_FLUSH_BYTES || millis() - _oldestPending >= LOG_FLUSH_INTERVAL_MS) {
+        flush();
+    }
+}
+
+void Logger::flush() {
+    if (_flushing.test_and_set()) return; // Another task is already flushing
+    TRACE_SCOPE("log.flush", "flash");
+
+    size_t tail = _tail;
+    size_t head = _head;
+    uint32_t dropped = _dropped.load();
+    if (head == tail && dropped == _reportedDropped) {
+        _flushing.clear();
+        return;
+    }
+
+    if (_segmentBytes >= LOG_SEGMENT_SIZE) rotate();
+
+    // Records about to leave the ring are echoed first, even if that has to wait on the UART
+    echo(head, SIZE_MAX);
+
+    File file = LittleFS.open(segmentPath(_curSeg), "a");
     if (!file) {
         Serial.println("Failed to open log file");
+        _flushing.clear();
         return;
     }
-    while (file.available()) {
-        Serial.write(file.read());
+
+    if (dropped != _reportedDropped) {
+        char note[48];
+        int n = snprintf(note, sizeof(note), "%lu log records dropped", (unsigned long)(dropped - _reportedDropped));
+        #ifdef CALID_LOG_BINARY
+        LogRecord rec = { (uint32_t)millis(), LOG_WARN, LOG_MOD_SYSTEM, (uint16_t)n };
+        _segmentBytes += file.write((const uint8_t*)&rec, sizeof(rec));
+        _segmentBytes += file.write((const uint8_t*)note, n);
+        #else
+        _segmentBytes += file.printf("--- %s ---\n", note);
+        #endif
+        _reportedDropped = dropped;
     }
+
+    // Producers only move _head, so the [tail, head) span is stable while we write it
+    _segmentBytes += writeRecords(file, tail, head);
     file.close();
+
+    LOG_LOCK();
+    _tail = head;
+    _oldestPending = millis();
+    LOG_UNLOCK();
+    _flushing.clear();
+}
+
+void Logger::printLogs() {
+    flush();
+    for (uint32_t seq = _firstSeg; seq <= _curSeg; seq++) {
+        File file = LittleFS.open(segmentPath(seq), "r");
+        if (!file) continue;
+        while (file.available()) {
+            Serial.write(file.read());
+        }
+        file.close();
+    }
 }
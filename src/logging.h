@@ -3,17 +3,147 @@
 
 #include <Arduino.h>
 #include <LittleFS.h>
+#include <atomic>
 
+#if defined(ESP8266)
+#define LOG_BUFFER_SIZE 2048
+#else
+#define LOG_BUFFER_SIZE 4096
+#endif
+#define LOG_FLUSH_BYTES 512          // Flush once a flash page worth is pending
+#define LOG_FLUSH_INTERVAL_MS 10000  // ...or when the oldest line is this old
+#define LOG_SEGMENT_SIZE 8192        // Roll to a new segment past this size
+#define LOG_MIN_SEGMENTS 2
+#define LOG_MAX_FS_SHARE 4           // Logs may take at most 1/N of the filesystem
+#define LOG_DEFAULT_BUDGET 65536
+#define LOG_LINE_MAX 160             // Formatted message limit, longer ones are truncated
+#define LOG_ECHO_RECORDS 4           // Serial echo per loop() pass, so a burst never stalls the loop
+
+// Numeric so they can be compared by the preprocessor
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO 1
+#define LOG_LEVEL_WARN 2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE 4
+
+// Levels below this are compiled out entirely (-D CALID_LOG_LEVEL=2 for WARN+)
+#ifndef CALID_LOG_LEVEL
+#define CALID_LOG_LEVEL LOG_LEVEL_DEBUG
+#endif
+
+// -D CALID_LOG_BINARY stores packed LogRecord entries on flash instead of text lines
+enum LogLevel : uint8_t {
+    LOG_DEBUG = LOG_LEVEL_DEBUG,
+    LOG_INFO = LOG_LEVEL_INFO,
+    LOG_WARN = LOG_LEVEL_WARN,
+    LOG_ERROR = LOG_LEVEL_ERROR
+};
+
+enum LogModule : uint8_t {
+    LOG_MOD_SYSTEM = 0,
+    LOG_MOD_CONFIG,
+    LOG_MOD_WIFI,
+    LOG_MOD_MQTT,
+    LOG_MOD_WEB,
+    LOG_MOD_SENSOR,
+    LOG_MOD_OTA,
+    LOG_MOD_COUNT
+};
+
+// Ring/binary-flash record header, followed by `length` message bytes
+struct __attribute__((packed)) LogRecord {
+    uint32_t millis;
+    uint8_t level;
+    uint8_t module;
+    uint16_t length;
+};
+
+// Records are packed into a RAM ring and written to flash in batches from loop(),
+// so logging never touches the filesystem or the UART and never blocks. loop()
+// also echoes records to Serial a few at a time while the TX buffer has room. On flash the log is a
+// series of fixed-size segments <dir>/log.<seq>; the oldest is deleted as a whole
+// once the total budget is exceeded.
 class Logger {
 public:
-    Logger(const char* logFileName = "/log.txt");
+    Logger(const char* logDir = "/logs");
     void begin();
-    void log(const String& message);
+    void loop();
+
+    bool enabled(LogModule module, LogLevel level) const { return level >= _levels[module]; }
+    void logf(LogModule module, LogLevel level, const char* fmt, ...) __attribute__((format(printf, 4, 5)));
+    void write(LogModule module, LogLevel level, const char* message, size_t len);
+    void log(const String& message, LogLevel level = LOG_INFO);
+
+    // Runtime filter, e.g. "*=warn,mqtt=debug"
+    void setLevel(LogModule module, LogLevel level) { _levels[module] = level; }
+    bool applyLevelSpec(const char* spec);
+    static const char* moduleName(LogModule module);
+
+    void flush(); // Call before restart/OTA
     void printLogs();
+    void setBudget(uint32_t bytes);
+    // Between LOG_MIN_SEGMENTS segments and the filesystem share; signed so a
+    // negative form value is not read as a huge budget
+    static uint32_t clampBudget(int64_t bytes);
+    uint32_t droppedCount() const { return _dropped.load(); }
+
+    // Segments currently on flash, oldest first; empty when first > last
+    uint32_t firstSegment() const { return _firstSeg; }
+    uint32_t lastSegment() const { return _curSeg; }
+    String segmentPath(uint32_t seq) const;
 
 private:
-    String logFileName;
-    void appendToFile(const String& message);
+    String logDir;
+    LogLevel _levels[LOG_MOD_COUNT];
+    uint8_t _ring[LOG_BUFFER_SIZE];
+    volatile size_t _head;  // Next byte to write (producers)
+    volatile size_t _tail;  // Next byte to flush (consumer)
+    size_t _echoed;         // Next record to echo to Serial, between _tail and _head
+    std::atomic<uint32_t> _dropped;
+    uint32_t _reportedDropped;
+    unsigned long _oldestPending;
+    std::atomic_flag _flushing = ATOMIC_FLAG_INIT;
+    #ifdef ESP32
+    portMUX_TYPE _mux = portMUX_INITIALIZER_UNLOCKED;
+    #endif
+
+    // In-memory write cursor, recovered from the directory once at boot
+    uint32_t _firstSeg;
+    uint32_t _curSeg;
+    size_t _segmentBytes;
+    uint32_t _maxSegments;
+
+    size_t pending() const;
+    void enqueue(const void* data, size_t len);
+    void peek(size_t pos, void* out, size_t len) const;
+    size_t formatRecord(size_t& pos, char* line, size_t size) const;
+    size_t writeRecords(File& file, size_t tail, size_t head);
+    void echo(size_t head, size_t maxRecords);
+    void scanSegments();
+    void rotate();
 };
 
-#endif // LOGGING_H
\ No newline at end of file
+extern Logger logger;
+
+#if CALID_LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOGD(mod, fmt, ...) do { if (logger.enabled(mod, LOG_DEBUG)) logger.logf(mod, LOG_DEBUG, fmt, ##__VA_ARGS__); } while (0)
+#else
+#define LOGD(mod, fmt, ...) do {} while (0)
+#endif
+#if CALID_LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOGI(mod, fmt, ...) do { if (logger.enabled(mod, LOG_INFO)) logger.logf(mod, LOG_INFO, fmt, ##__VA_ARGS__); } while (0)
+#else
+#define LOGI(mod, fmt, ...) do {} while (0)
+#endif
+#if CALID_LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOGW(mod, fmt, ...) do { if (logger.enabled(mod, LOG_WARN)) logger.logf(mod, LOG_WARN, fmt, ##__VA_ARGS__); } while (0)
+#else
+#define LOGW(mod, fmt, ...) do {} while (0)
+#endif
+#if CALID_LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOGE(mod, fmt, ...) do { if (logger.enabled(mod, LOG_ERROR)) logger.logf(mod, LOG_ERROR, fmt, ##__VA_ARGS__); } while (0)
+#else
+#define LOGE(mod, fmt, ...) do {} while (0)
+#endif
+
+#endif // LOGGING_H
@@ -22,9 +22,19 @@
 #include "mqtt_manager.h"
 #include "wifi_setup.h"
 #include "ota_manager.h"
+#include "config_reload.h"
+#include "history_store.h"
+#include "metrics.h"
+#include "boot_profile.h"
+#include "telemetry.h"
+#include "pipeline.h"
+#include "duty_cycle.h"
+#include "time_sync.h"
+#include "scheduler.h"
+#include "heap_monitor.h"
+#include "power_manager.h"
+#include "edge_capture.h"
 
-#include <NTPClient.h>
-#include <WiFiUdp.h>
 #include <Wire.h>
 #include <ArduinoJson.h>
 
@@ -38,74 +48,118 @@ IPAddress apIP(192, 168, 4, 1);
 DNSServer dnsServer;
 Sensor sensor;
 CalidWebServer webServer;
-Logger logger("/log.txt");
+Logger logger("/logs");
 
-WiFiUDP udp;
-NTPClient timeClient(udp, "pool.ntp.org", 0, 60000);
-bool timeSynced = false;
+bool connectWiFi();
+void registerLoopTasks();
+void sampleAndSend();
 
-void connectWiFi();
-String getTime();
+// Association was started early in setup(); this only waits for it (or runs the portal)
+bool connectWiFi() {
+    BootPhase phase("wifi_wait");
+    // Duty-cycle wakes run unattended: no portal, just go back to sleep
+    if (!runWifiSetup(!DutyCycle::active())) return false;
 
-void connectWiFi() {
-    runWifiSetup();
-
-    Serial.println("WiFi Connected!");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
+    LOGI(LOG_MOD_WIFI, "Connected, IP address: %s", WiFi.localIP().toString().c_str());
     
-    timeClient.begin();
-    timeClient.setPoolServerName(config.ntpServer);
-    timeClient.update();
-    timeSynced = timeClient.getEpochTime() > 0;
+    TimeSync::begin();
+    if (!DutyCycle::active()) PowerManager::begin();
+    return true;
 }
 
 void setup() {
+    int setupPhase = BootProfile::begin("setup");
     Serial.begin(115200);
-    delay(1000);
     Serial.println("\n\n===============================");
     Serial.println("Calid ESP Sensor Gateway");
     Serial.printf("Version: %s\n", SW_VERSION.c_str());
     Serial.println("===============================\n");
     
-    #ifdef ESP32
-    if(!LittleFS.begin(true)){
-    #else
-    if(!LittleFS.begin()){
-    #endif
-        Serial.println("LittleFS Mount Failed");
+    {
+        BootPhase phase("fs_mount");
+        #ifdef ESP32
+        if(!LittleFS.begin(true)){
+        #else
+        if(!LittleFS.begin()){
+        #endif
+            Serial.println("LittleFS Mount Failed");
+        }
+    }
+
+    {
+        BootPhase phase("config_load");
+        config.load();
+    }
+
+    // Sample-only duty-cycle wakes end in here, back in deep sleep
+    if (DutyCycle::begin() == DUTY_SAMPLE) DutyCycle::sample();
+
+    {
+        BootPhase phase("storage");
+        logger.setBudget(config.logBudget);
+        logger.applyLevelSpec(config.logLevels);
+        logger.begin();
+        historyStore.begin();
     }
+    LOGI(LOG_MOD_SYSTEM, "System starting v%s [AdoptionCode: %s]", SW_VERSION.c_str(), config.getAdoptionCode().c_str());
 
-    config.load();
-    logger.begin();
-    logger.log("System starting v" + SW_VERSION + " [AdoptionCode: " + config.getAdoptionCode() + "]");
+    // Kick off association first; everything up to connectWiFi() overlaps with it
+    {
+        BootPhase phase("wifi_start");
+        beginWifiConnect();
+    }
     
     Wire.begin(); 
     
-    timeClient.setTimeOffset(config.utcOffset);
-
     if (config.testingMode) {
-        Serial.println("Testing mode enabled.");
-    } else {
+        LOGI(LOG_MOD_SYSTEM, "Testing mode enabled");
+    } else if (!DutyCycle::active()) {
+        BootPhase phase("sensors");
         sensor.begin();
     }
 
-    connectWiFi();
     mqttManager.begin();
-    webServer.begin();
+
+    bool connected = connectWiFi();
+    if (DutyCycle::active()) DutyCycle::uploadAndSleep(connected);
+
+    // Only once associated: the setup portal needs port 80 to itself, and begin()
+    // picks captive DNS and redirects from the final WiFi mode
+    {
+        BootPhase phase("web_server");
+        webServer.begin();
+    }
 
     mqttManager.setCommandCallback([](String topic, String payload) {
         String ackTopic = "sensors/" + String(config.sensorId) + "/ack";
         
         if (payload == "restart") {
-            Serial.println("Remote restart command received");
+            LOGI(LOG_MOD_MQTT, "Remote restart command received");
             mqttManager.publishRaw(ackTopic.c_str(), "restarting");
+            logger.flush();
             delay(500);
             ESP.restart();
         } else if (payload == "toggle_sim") {
+            std::unique_ptr<Config> previous = ConfigReload::snapshot();
+            if (!previous) {
+                mqttManager.publishRaw(ackTopic.c_str(), "busy");
+                return;
+            }
             config.testingMode = !config.testingMode;
             config.save();
+            ConfigReload::schedule(ConfigReload::diff(*previous, config));
             mqttManager.publishRaw(ackTopic.c_str(), config.testingMode ? "sim_on" : "sim_off");
+        #ifdef CALID_BENCHMARK
+        } else if (payload == "benchmark_sensors") {
+            static const int counts[] = { 4, 16, 64 };
+            String result;
+            {
+                SensorLock lock;
+                result = sensor.benchmark(counts, 3);
+            }
+            LOGI(LOG_MOD_SENSOR, "Benchmark: %s", result.c_str());
+            mqttManager.publishRaw(ackTopic.c_str(), result.c_str());
+        #endif
         } else if (payload == "update") {
             if (strlen(config.firmwareUrl) > 0) {
                 mqttManager.publishRaw(ackTopic.c_str(), "updating");
@@ -116,159 +170,82 @@ void setup() {
         } else if (payload.startsWith("{")) {
             JsonDocument updateDoc;
             DeserializationError err = deserializeJson(updateDoc, payload);
-            if (!err) {
-                if (!updateDoc["sensorId"].isNull()) strlcpy(config.sensorId, updateDoc["sensorId"], sizeof(config.sensorId));
-                if (!updateDoc["utcOffset"].isNull()) config.utcOffset = updateDoc["utcOffset"];
-                if (!updateDoc["ntpServer"].isNull()) strlcpy(config.ntpServer, updateDoc["ntpServer"], sizeof(config.ntpServer));
-                if (!updateDoc["mqttTopicPrefix"].isNull()) strlcpy(config.mqttTopicPrefix, updateDoc["mqttTopicPrefix"], sizeof(config.mqttTopicPrefix));
-                
-                config.save();
-                mqttManager.publishRaw(ackTopic.c_str(), "config_updated");
-                Serial.println("Remote configuration updated via MQTT");
+            if (err) return;
+            std::unique_ptr<Config> previous = ConfigReload::snapshot();
+            if (!previous) {
+                mqttManager.publishRaw(ackTopic.c_str(), "busy");
+                return;
             }
+            if (!updateDoc["sensorId"].isNull()) strlcpy(config.sensorId, updateDoc["sensorId"], sizeof(config.sensorId));
+            if (!updateDoc["utcOffset"].isNull()) config.utcOffset = updateDoc["utcOffset"];
+            if (!updateDoc["ntpServer"].isNull()) strlcpy(config.ntpServer, updateDoc["ntpServer"], sizeof(config.ntpServer));
+            if (!updateDoc["mqttTopicPrefix"].isNull()) strlcpy(config.mqttTopicPrefix, updateDoc["mqttTopicPrefix"], sizeof(config.mqttTopicPrefix));
+            if (!updateDoc["logLevels"].isNull()) strlcpy(config.logLevels, updateDoc["logLevels"], sizeof(config.logLevels));
+            
+            config.save();
+            ConfigReload::schedule(ConfigReload::diff(*previous, config));
+            mqttManager.publishRaw(ackTopic.c_str(), "config_updated");
+            LOGI(LOG_MOD_CONFIG, "Remote configuration updated via MQTT");
         }
     });
+    Pipeline::begin();
+    registerLoopTasks();
+    Scheduler::begin();
+    BootProfile::end(setupPhase);
 }
 
-unsigned long lastDataLog = 0;
-unsigned long lastHeartbeat = 0;
-
-void loop() {
-    webServer.handleClient(); 
-    mqttManager.loop();
-    OtaManager::loop();
+// Single-threaded path: sample, store and send on the loop
+void sampleAndSend() {
+    if (WiFi.status() != WL_CONNECTED) return;
+    uint32_t start = millis();
+    metrics.sampleJitter.observe(Scheduler::lateMs() * 1000);
 
-    unsigned long now = millis();
-
-    // Periodic Heartbeat / Status
-    if (now - lastHeartbeat > 300000 || lastHeartbeat == 0) { // 5 mins
-        lastHeartbeat = now;
-        if (mqttManager.isConnected()) {
-            mqttManager.publishStatus("online");
-        }
-    }
-
-    if (WiFi.status() == WL_CONNECTED) {
-        if (!timeSynced) {
-            timeClient.update();
-            timeSynced = timeClient.getEpochTime() > 28800; // After 1970
-        }
+    if (!acquireSample()) return;
 
-        // Only run data collection every 60s
-        if (now - lastDataLog < 60000 && lastDataLog != 0) return;
-        lastDataLog = now;
+    historyStore.append(allSensorData.data(), activeSensorCount);
 
-        if (config.testingMode) {
-            activeSensorCount = 2;
-            allSensorData[0].pin = 4;
-            allSensorData[0].sensorType = "DHT22";
-            allSensorData[0].valid = true;
-            allSensorData[0].readings.clear();
-            allSensorData[0].readings.push_back({"Temperature", 22.5f + (random(-20, 20) / 10.0f), "C"});
-            allSensorData[0].readings.push_back({"Humidity", 45.0f + (random(-50, 50) / 10.0f), "%"});
-
-            allSensorData[1].pin = 5;
-            allSensorData[1].sensorType = "BME280";
-            allSensorData[1].valid = true;
-            allSensorData[1].readings.clear();
-            allSensorData[1].readings.push_back({"Temperature", 24.1f + (random(-20, 20) / 10.0f), "C"});
-            allSensorData[1].readings.push_back({"Humidity", 40.0f + (random(-50, 50) / 10.0f), "%"});
-            allSensorData[1].readings.push_back({"Pressure", 1012.5f + (random(-100, 100) / 10.0f), "hPa"});
-        } else {
-            sensor.update();
-        }
-
-        if (mqttManager.isConnected()) {
-            JsonDocument mqttDoc;
-            mqttDoc["sensorId"] = config.sensorId;
-            mqttDoc["adoptionCode"] = config.getAdoptionCode();
-            
-            SystemHealth health = config.getSystemHealth();
-            JsonObject sys = mqttDoc["system"].to<JsonObject>();
-            sys["rssi"] = health.rssi;
-            sys["uptime"] = health.uptime;
-            sys["freeHeap"] = health.freeHeap;
-            sys["resetReason"] = health.resetReason;
-
-            JsonArray sensorsArr = mqttDoc["sensors"].to<JsonArray>();
-
-            for (int i = 0; i < activeSensorCount; i++) {
-                if (allSensorData[i].valid) {
-                    JsonObject s = sensorsArr.add<JsonObject>();
-                    s["pin"] = allSensorData[i].pin;
-                    s["type"] = allSensorData[i].sensorType;
-                    JsonArray rd = s["readings"].to<JsonArray>();
-                    for (const auto& r : allSensorData[i].readings) {
-                        JsonObject ro = rd.add<JsonObject>();
-                        ro["type"] = r.type;
-                        ro["value"] = r.value;
-                        ro["unit"] = r.unit;
-                    }
-                }
-            }
-            String mqttPayload;
-            serializeJson(mqttDoc, mqttPayload);
+    if (mqttManager.isConnected()) {
+        String mqttPayload = encodeMqttTelemetry(allSensorData.data(), activeSensorCount);
+        if (mqttPayload.length()) {
+            MetricsTimer publishTimer(metrics.mqttPublish);
             mqttManager.publishTelemetry(mqttPayload.c_str());
+            BootProfile::mark("first_sample");
         }
+    }
 
-        String apiEndpoint = String(config.apiEndpoint);
-        if (apiEndpoint.length() > 0) {
-            bool isHttps = apiEndpoint.startsWith("https://");
-            HTTPClient http;
-            WiFiClient client;
-            WiFiClientSecure secureClient;
-
-            if (isHttps) {
-                secureClient.setInsecure();
-                http.begin(secureClient, apiEndpoint + "/sensor/data/write");
-            } else {
-                http.begin(client, apiEndpoint + "/sensor/data/write");
-            }
-
-            http.addHeader("Content-Type", "application/json");
-            http.addHeader("X-Sensor-Id", config.sensorId);
-            http.addHeader("X-Sensor-Api-Key", config.apiKey);
-
-            String timeStr = getTime();
-            String payload = "[";
-            bool first = true;
-            for (int i = 0; i < activeSensorCount; i++) {
-                if (!allSensorData[i].valid) continue;
+    if (strlen(config.apiEndpoint) > 0) {
+        String payload = encodeHttpUpload(allSensorData.data(), activeSensorCount);
+        if (postHttpUpload(payload) > 0) BootProfile::mark("first_sample");
+    }
+    metrics.pipelineLatency.observe((millis() - start) * 1000);
+}
 
-                for (const auto& r : allSensorData[i].readings) {
-                    if (!first) payload += ",";
-                    payload += "{\"time\":\"" + timeStr + 
-                               "\",\"sensor_id\":\"" + String(config.sensorId) + 
-                               "\",\"pin\":" + String(allSensorData[i].pin) + 
-                               ",\"sensor_type\":\"" + allSensorData[i].sensorType +
-                               "\",\"data_type\":\"" + r.type + 
-                               "\",\"value\":\"" + String(r.value) + 
-                               "\",\"unit\":\"" + r.unit + "\"}";
-                    first = false;
-                }
-            }
-            payload += "]";
+// Budgets are what a healthy pass takes; network calls that block (MQTT connect,
+// HTTP POST) show up as overruns rather than silently delaying everything else
+void registerLoopTasks() {
+    Scheduler::add("web", 0, 2000, []() { webServer.handleClient(); });
+    OtaManager::begin();
+    ConfigReload::begin();
+    Scheduler::add("logger", 100, 50000, []() { logger.loop(); });
+    HeapMonitor::begin();
+    Scheduler::add("heap", HEAP_SAMPLE_INTERVAL_MS, 2000, HeapMonitor::sample);
+    EdgeCapture::begin();
+
+    // Sampling, encoding and transport run in their own tasks
+    if (Pipeline::running()) return;
+
+    Scheduler::add("mqtt", 0, 20000, []() { mqttManager.loop(); });
+    Scheduler::add("sensors", 0, 20000, []() { if (!config.testingMode) sensor.loop(); });
+    Scheduler::add("heartbeat", HEARTBEAT_INTERVAL_MS, 20000, []() {
+        if (mqttManager.isConnected()) mqttManager.publishStatus("online");
+    });
+    Scheduler::add("sample", SENSOR_TICK_MS, 500000, sampleAndSend);
+}
 
-            if (!first) {
-                int httpResponseCode = http.POST(payload);
-                if (httpResponseCode > 0) {
-                    Serial.println("HTTP Success: " + String(httpResponseCode));
-                } else {
-                    Serial.println("HTTP Error: " + String(httpResponseCode));
-                }
-            }
-            http.end();
-        }
+void loop() {
+    {
+        MetricsTimer loopTimer(metrics.loopIteration);
+        Scheduler::run();
     }
+    PowerManager::idle();
 }
-
-String getTime() {
-  if (WiFi.status() == WL_CONNECTED) {
-    timeClient.update();
-  }
-  time_t now = timeClient.getEpochTime();
-  struct tm* timeinfo = localtime(&now);
-  char buffer[20];
-  strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", timeinfo);
-  return String(buffer);
-}
\ No newline at end of file
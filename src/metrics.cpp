@@ -0,0 +1,211 @@
+#include "metrics.h"
+#include "sensor.h"
+#include "mqtt_manager.h"
+#include "logging.h"
+#include "heap_monitor.h"
+
+Metrics metrics;
+
+const uint32_t LatencyHistogram::bounds[METRICS_BUCKETS] = {
+    50, 100, 250, 500, 1000, 2500, 5000, 10000,
+    25000, 50000, 100000, 250000, 500000, 1000000, 2500000, 5000000
+};
+
+// Same bounds in seconds, pre-formatted so exposition never formats floats for labels
+static const char* const bucketLabels[METRICS_BUCKETS] = {
+    "5e-05", "0.0001", "0.00025", "0.0005", "0.001", "0.0025", "0.005", "0.01",
+    "0.025", "0.05", "0.1", "0.25", "0.5", "1", "2.5", "5"
+};
+
+LatencyHistogram::LatencyHistogram() : _count(0), _sumLow(0), _sumHigh(0) {
+    for (int i = 0; i <= METRICS_BUCKETS; i++) _buckets[i].store(0, std::memory_order_relaxed);
+}
+
+void LatencyHistogram::observe(uint32_t us) {
+    int i = 0;
+    while (i < METRICS_BUCKETS && us > bounds[i]) i++;
+    _buckets[i].fetch_add(1, std::memory_order_relaxed);
+    _count.fetch_add(1, std::memory_order_relaxed);
+
+    uint32_t prev = _sumLow.fetch_add(us, std::memory_order_relaxed);
+    if (prev + us < prev) _sumHigh.fetch_add(1, std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::sumMicros() const {
+    return ((uint64_t)_sumHigh.load(std::memory_order_relaxed) << 32) | _sumLow.load(std::memory_order_relaxed);
+}
+
+Metrics::Metrics() {
+    for (int i = 0; i < HTTP_CLASS_COUNT; i++) uploadStatus[i].store(0, std::memory_order_relaxed);
+}
+
+void Metrics::recordUploadStatus(int code) {
+    int cls = (code >= 100 && code < 600) ? code / 100 : HTTP_CLASS_ERROR;
+    uploadStatus[cls].fetch_add(1, std::memory_order_relaxed);
+}
+
+// ---- Exposition ----
+
+struct ScalarMetric {
+    const char* name;
+    const char* help;
+    const char* type;
+    uint32_t (*value)();
+};
+
+static const ScalarMetric scalars[] = {
+    { "calid_heap_free_bytes", "Free heap in bytes.", "gauge", []() -> uint32_t { return ESP.getFreeHeap(); } },
+    { "calid_heap_largest_free_block_bytes", "Largest contiguous free heap block in bytes.", "gauge", HeapMonitor::largestBlock },
+    { "calid_heap_fragmentation_percent", "Share of free heap outside the largest block.", "gauge", []() -> uint32_t { return HeapMonitor::fragmentation(); } },
+    { "calid_heap_min_free_bytes", "Lowest free heap seen since boot.", "gauge", HeapMonitor::minFreeHeap },
+    { "calid_heap_alloc_failures_total", "Heap allocations that returned NULL.", "counter", []() -> uint32_t { return allocStats.failures.load(); } },
+    { "calid_heap_tls_at_risk", "1 if the next TLS session is unlikely to fit in the heap.", "gauge", []() -> uint32_t { return HeapMonitor::tlsAtRisk() ? 1 : 0; } },
+    { "calid_stack_min_free_bytes", "Smallest stack headroom across tasks.", "gauge", []() -> uint32_t { return HeapMonitor::minStackFree(); } },
+    { "calid_uptime_seconds", "Seconds since boot.", "gauge", []() -> uint32_t { return millis() / 1000; } },
+    { "calid_mqtt_connected", "1 if the MQTT session is up.", "gauge", []() -> uint32_t { return mqttManager.isConnected() ? 1 : 0; } },
+    { "calid_mqtt_reconnect_attempts_total", "MQTT connection attempts.", "counter", []() -> uint32_t { return metrics.mqttReconnectAttempts.load(); } },
+    { "calid_mqtt_reconnect_failures_total", "Failed MQTT connection attempts.", "counter", []() -> uint32_t { return metrics.mqttReconnectFailures.load(); } },
+    { "calid_pipeline_dropped_total", "Samples or payloads dropped because a pipeline queue was full.", "counter", []() -> uint32_t { return metrics.pipelineDropped.load(); } },
+    { "calid_sensor_read_errors_total", "Failed sensor reads across all slots.", "counter", []() -> uint32_t { return metrics.sensorReadErrors.load(); } },
+    { "calid_i2c_bus_recoveries_total", "I2C bus resets after a stuck or unresponsive bus.", "counter", []() -> uint32_t { return metrics.i2cBusRecoveries.load(); } },
+    { "calid_wifi_fast_connects_total", "Associations made with the cached BSSID and channel.", "counter", []() -> uint32_t { return metrics.wifiFastConnects.load(); } },
+    { "calid_wifi_fast_connect_failures_total", "Cached associations that fell back to a scan.", "counter", []() -> uint32_t { return metrics.wifiFastConnectFailures.load(); } },
+    { "calid_scheduler_overruns_total", "Loop task runs that exceeded their time budget.", "counter", []() -> uint32_t { return metrics.schedulerOverruns.load(); } },
+    { "calid_edge_events_total", "Debounced edges captured on digital inputs.", "counter", []() -> uint32_t { return metrics.edgeEvents.load(); } },
+    { "calid_edge_events_unsent_total", "Digital input edges queued because they could not be published immediately.", "counter", []() -> uint32_t { return metrics.edgeEventsUnsent.load(); } },
+    { "calid_loop_stalls_total", "Loop tasks caught running past the soft watchdog limit.", "counter", []() -> uint32_t { return metrics.loopStalls.load(); } },
+    { "calid_log_dropped_total", "Log lines dropped because the RAM ring was full.", "counter", []() -> uint32_t { return logger.droppedCount(); } },
+    { "calid_web_admitted_total", "API requests admitted by the web server.", "counter", []() -> uint32_t { return metrics.webAdmitted.load(); } },
+    { "calid_web_rejected_busy_total", "API requests rejected at the in-flight cap.", "counter", []() -> uint32_t { return metrics.webRejectedBusy.load(); } },
+    { "calid_web_rejected_memory_total", "API requests rejected below the heap watermark.", "counter", []() -> uint32_t { return metrics.webRejectedMemory.load(); } },
+};
+static const int SCALAR_COUNT = sizeof(scalars) / sizeof(scalars[0]);
+
+struct HistogramMetric {
+    const char* name;
+    const char* help;
+    const char* labels; // Without braces, may be empty
+    LatencyHistogram* hist;
+};
+
+static const HistogramMetric histograms[] = {
+    { "calid_sensor_read_seconds", "Time spent in a single driver read.", "", &metrics.sensorRead },
+    { "calid_json_encode_seconds", "Time spent encoding telemetry payloads.", "", &metrics.jsonEncode },
+    { "calid_publish_seconds", "Telemetry publish latency.", "transport=\"mqtt\"", &metrics.mqttPublish },
+    { "calid_publish_seconds", "Telemetry publish latency.", "transport=\"http\"", &metrics.httpPost },
+    { "calid_sample_jitter_seconds", "Delay between a sample's scheduled and actual start.", "", &metrics.sampleJitter },
+    { "calid_pipeline_latency_seconds", "Time from sampling to the end of transport.", "", &metrics.pipelineLatency },
+    { "calid_edge_publish_seconds", "Time from a digital input edge to its MQTT event being sent.", "", &metrics.edgePublish },
+    { "calid_wifi_connect_seconds", "Time from starting association to an IP address.", "", &metrics.wifiConnect },
+    { "calid_loop_iteration_seconds", "Duration of one Arduino loop() pass.", "", &metrics.loopIteration },
+};
+static const int HISTOGRAM_COUNT = sizeof(histograms) / sizeof(histograms[0]);
+
+static const char* const statusLabels[HTTP_CLASS_COUNT] = { "error", "1xx", "2xx", "3xx", "4xx", "5xx" };
+
+enum MetricsSection {
+    SECTION_SCALARS = 0,
+    SECTION_UPLOAD_STATUS,
+    SECTION_READINGS,
+    SECTION_HISTOGRAMS,
+    SECTION_DONE
+};
+
+static void advance(MetricsCursor& cur) {
+    cur.section++;
+    cur.item = 0;
+    cur.sub = 0;
+}
+
+bool metricsNextLine(MetricsCursor& cur, char* out, size_t len) {
+    while (cur.section != SECTION_DONE) {
+        switch (cur.section) {
+            case SECTION_SCALARS: {
+                if (cur.item >= SCALAR_COUNT) { advance(cur); continue; }
+                const ScalarMetric& m = scalars[cur.item];
+                if (cur.sub == 0) snprintf(out, len, "# HELP %s %s\n", m.name, m.help);
+                else if (cur.sub == 1) snprintf(out, len, "# TYPE %s %s\n", m.name, m.type);
+                else snprintf(out, len, "%s %lu\n", m.name, (unsigned long)m.value());
+                if (++cur.sub == 3) { cur.sub = 0; cur.item++; }
+                return true;
+            }
+
+            case SECTION_UPLOAD_STATUS: {
+                if (cur.item == 0) {
+                    snprintf(out, len, "# HELP calid_upload_responses_total HTTP upload responses by status class.\n");
+                } else if (cur.item == 1) {
+                    snprintf(out, len, "# TYPE calid_upload_responses_total counter\n");
+                } else if (cur.item - 2 < HTTP_CLASS_COUNT) {
+                    int cls = cur.item - 2;
+                    snprintf(out, len, "calid_upload_responses_total{code=\"%s\"} %lu\n",
+                             statusLabels[cls], (unsigned long)metrics.uploadStatus[cls].load());
+                } else {
+                    advance(cur);
+                    continue;
+                }
+                cur.item++;
+                return true;
+            }
+
+            case SECTION_READINGS: {
+                if (cur.item == 0 && cur.sub == 0) {
+                    cur.readings = sensorSnapshot();
+                    snprintf(out, len, "# HELP calid_reading Latest sensor reading.\n");
+                    cur.sub = 1;
+                    return true;
+                }
+                if (cur.item == 0 && cur.sub == 1) {
+                    snprintf(out, len, "# TYPE calid_reading gauge\n");
+                    cur.item = 1;
+                    cur.sub = 0;
+                    return true;
+                }
+                int idx = cur.item - 1;
+                if (idx >= (int)cur.readings->data.size()) { cur.readings.reset(); advance(cur); continue; }
+                const SensorReadings& s = cur.readings->data[idx];
+                if (!s.valid || cur.sub >= (int)s.readings.size()) {
+                    cur.item++;
+                    cur.sub = 0;
+                    continue;
+                }
+                const Reading& r = s.readings[cur.sub++];
+                snprintf(out, len, "calid_reading{pin=\"%d\",sensor=\"%s\",type=\"%s\",unit=\"%s\",device=\"%s\"} %.3f\n",
+                         s.pin, s.sensorType.c_str(), r.type.c_str(), r.unit.c_str(), r.device.c_str(), r.value);
+                return true;
+            }
+
+            case SECTION_HISTOGRAMS: {
+                if (cur.item >= HISTOGRAM_COUNT) { advance(cur); continue; }
+                const HistogramMetric& m = histograms[cur.item];
+                bool newFamily = cur.item == 0 || strcmp(histograms[cur.item - 1].name, m.name) != 0;
+                const char* sep = m.labels[0] ? "," : "";
+
+                // sub: 0 HELP, 1 TYPE, 2..2+N buckets (last is +Inf), then sum, count
+                if (cur.sub < 2 && !newFamily) cur.sub = 2;
+                if (cur.sub == 0) {
+                    snprintf(out, len, "# HELP %s %s\n", m.name, m.help);
+                } else if (cur.sub == 1) {
+                    snprintf(out, len, "# TYPE %s histogram\n", m.name);
+                } else if (cur.sub - 2 <= METRICS_BUCKETS) {
+                    int b = cur.sub - 2;
+                    uint32_t cumulative = 0;
+                    for (int i = 0; i <= b; i++) cumulative += m.hist->bucket(i);
+                    snprintf(out, len, "%s_bucket{%s%sle=\"%s\"} %lu\n", m.name, m.labels, sep,
+                             b < METRICS_BUCKETS ? bucketLabels[b] : "+Inf", (unsigned long)cumulative);
+                } else if (cur.sub - 2 == METRICS_BUCKETS + 1) {
+                    snprintf(out, len, m.labels[0] ? "%s_sum{%s} %.6f\n" : "%s_sum%s %.6f\n",
+                             m.name, m.labels, m.hist->sumMicros() / 1000000.0);
+                } else {
+                    snprintf(out, len, m.labels[0] ? "%s_count{%s} %lu\n" : "%s_count%s %lu\n",
+                             m.name, m.labels, (unsigned long)m.hist->count());
+                    cur.item++;
+                    cur.sub = 0;
+                    return true;
+                }
+                cur.sub++;
+                return true;
+            }
+        }
+    }
+    return false;
+}
@@ -0,0 +1,97 @@
+#ifndef CALID_METRICS_H
+#define CALID_METRICS_H
+
+#include <Arduino.h>
+#include <atomic>
+#include <memory>
+
+#define METRICS_BUCKETS 16
+
+// Fixed-bucket latency histogram. observe() is a handful of relaxed atomic adds,
+// so it is cheap enough to stay on the hot path.
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+    void observe(uint32_t micros);
+
+    uint32_t bucket(int i) const { return _buckets[i].load(std::memory_order_relaxed); } // Non-cumulative, i <= METRICS_BUCKETS
+    uint32_t count() const { return _count.load(std::memory_order_relaxed); }
+    uint64_t sumMicros() const;
+
+    static const uint32_t bounds[METRICS_BUCKETS]; // Upper bounds in us; bucket METRICS_BUCKETS is +Inf
+
+private:
+    std::atomic<uint32_t> _buckets[METRICS_BUCKETS + 1];
+    std::atomic<uint32_t> _count;
+    std::atomic<uint32_t> _sumLow;
+    std::atomic<uint32_t> _sumHigh;
+};
+
+// Observes the lifetime of the scope into a histogram
+class MetricsTimer {
+public:
+    explicit MetricsTimer(LatencyHistogram& h) : _h(h), _start(micros()) {}
+    ~MetricsTimer() { _h.observe(micros() - _start); }
+private:
+    LatencyHistogram& _h;
+    uint32_t _start;
+};
+
+enum HttpStatusClass {
+    HTTP_CLASS_ERROR = 0, // Transport failure, no status line
+    HTTP_CLASS_1XX,
+    HTTP_CLASS_2XX,
+    HTTP_CLASS_3XX,
+    HTTP_CLASS_4XX,
+    HTTP_CLASS_5XX,
+    HTTP_CLASS_COUNT
+};
+
+struct Metrics {
+    LatencyHistogram sensorRead;
+    LatencyHistogram jsonEncode;
+    LatencyHistogram mqttPublish;
+    LatencyHistogram httpPost;
+    LatencyHistogram loopIteration;
+    LatencyHistogram wifiConnect;
+    LatencyHistogram sampleJitter;    // How late a sample started against its schedule
+    LatencyHistogram pipelineLatency; // Sample taken to transport done
+    LatencyHistogram edgePublish;     // Digital input edge to its MQTT event going out
+
+    std::atomic<uint32_t> mqttReconnectAttempts{0};
+    std::atomic<uint32_t> mqttReconnectFailures{0};
+    std::atomic<uint32_t> pipelineDropped{0};
+    std::atomic<uint32_t> sensorReadErrors{0};
+    std::atomic<uint32_t> i2cBusRecoveries{0};
+    std::atomic<uint32_t> wifiFastConnects{0};
+    std::atomic<uint32_t> wifiFastConnectFailures{0};
+    std::atomic<uint32_t> schedulerOverruns{0};
+    std::atomic<uint32_t> loopStalls{0};
+    std::atomic<uint32_t> edgeEvents{0};        // Debounced digital input edges
+    std::atomic<uint32_t> edgeEventsUnsent{0};  // Edges queued for a retry (MQTT busy or down)
+    std::atomic<uint32_t> uploadStatus[HTTP_CLASS_COUNT];
+
+    std::atomic<uint32_t> webAdmitted{0};
+    std::atomic<uint32_t> webRejectedBusy{0};
+    std::atomic<uint32_t> webRejectedMemory{0};
+
+    Metrics();
+    void recordUploadStatus(int code);
+};
+
+// Incremental Prometheus text exposition; one line per call so the web server
+// can stream it without building the whole document.
+struct SensorSnapshot;
+
+struct MetricsCursor {
+    int section = 0;
+    int item = 0;
+    int sub = 0;
+    std::shared_ptr<const SensorSnapshot> readings; // Pinned for the whole exposition
+};
+
+bool metricsNextLine(MetricsCursor& cur, char* out, size_t len);
+
+extern Metrics metrics;
+
+#endif
@@ -1,4 +1,8 @@
 #include "mqtt_manager.h"
+#include "metrics.h"
+#include "logging.h"
+#include "boot_profile.h"
+#include "trace.h"
 #include <Arduino.h>
 #if defined(ESP8266)
 #include <ESP8266WiFi.h>
@@ -8,7 +12,9 @@
 
 MqttManager mqttManager;
 
-MqttManager::MqttManager() : lastReconnectAttempt(0), _commandCallback(nullptr) {}
+MqttManager::MqttManager() : lastReconnectAttempt(0), _commandCallback(nullptr), _connected(false) {
+    _connectedSensorId[0] = '\0';
+}
 
 void MqttManager::begin() {
     if (!config.mqttEnabled) return;
@@ -27,29 +33,44 @@ void MqttManager::begin() {
     }
 
     client.setServer(config.mqttBroker, config.mqttPort);
+    client.setBufferSize(MQTT_BUFFER_SIZE);
     client.setCallback([this](char* topic, byte* payload, unsigned int length) {
         this->internalCallback(topic, payload, length);
     });
 }
 
+// Drops the current session and re-applies broker settings; the next loop() reconnects
+void MqttManager::reconfigure() {
+    if (client.connected()) {
+        String statusTopic = "sensors/" + String(_connectedSensorId) + "/status";
+        client.publish(statusTopic.c_str(), "offline", true);
+        client.disconnect();
+    }
+    _connected = false;
+    lastReconnectAttempt = 0;
+    begin();
+}
+
 void MqttManager::loop() {
     if (!config.mqttEnabled) return;
 
     if (!client.connected()) {
         long now = millis();
-        if (now - lastReconnectAttempt > 5000) {
+        if (now - lastReconnectAttempt > 5000 || lastReconnectAttempt == 0) {
             lastReconnectAttempt = now;
             reconnect();
         }
     } else {
         client.loop();
     }
+    _connected = client.connected();
 }
 
 void MqttManager::reconnect() {
     if (WiFi.status() != WL_CONNECTED) return;
 
-    Serial.print("Attempting MQTT connection...");
+    LOGD(LOG_MOD_MQTT, "Attempting connection to %s:%d", config.mqttBroker, config.mqttPort);
+    metrics.mqttReconnectAttempts++;
     
     String clientId = "CalidESP-";
     clientId += config.getAdoptionCode();
@@ -57,30 +78,71 @@ void MqttManager::reconnect() {
     String statusTopic = "sensors/" + String(config.sensorId) + "/status";
     
     // Connect with LWT (Last Will and Testament)
-    if (client.connect(clientId.c_str(), config.mqttUser, config.mqttPassword, 
-                       statusTopic.c_str(), 1, true, "offline")) {
-        Serial.println("connected");
+    bool connected;
+    {
+        TRACE_SCOPE("mqtt.connect", "net");
+        connected = client.connect(clientId.c_str(), config.mqttUser, config.mqttPassword,
+                                   statusTopic.c_str(), 1, true, "offline");
+    }
+    if (connected) {
+        LOGI(LOG_MOD_MQTT, "Connected to %s", config.mqttBroker);
+        strlcpy(_connectedSensorId, config.sensorId, sizeof(_connectedSensorId));
         
         // Publish online status
         client.publish(statusTopic.c_str(), "online", true);
+
+        // The first status after boot is followed by the boot-phase breakdown
+        if (!BootProfile::reported()) {
+            BootProfile::mark("mqtt_connected");
+            JsonDocument bootDoc;
+            bootDoc["status"] = "online";
+            BootProfile::toJson(bootDoc["boot"].to<JsonObject>());
+            String payload;
+            serializeJson(bootDoc, payload);
+            String bootTopic = "sensors/" + String(config.sensorId) + "/status/boot";
+            if (client.publish(bootTopic.c_str(), payload.c_str())) BootProfile::setReported();
+        }
         
         // Subscribe to commands
         String commandTopic = "sensors/" + String(config.sensorId) + "/commands";
         client.subscribe(commandTopic.c_str());
         
-        Serial.printf("Subscribed to %s\n", commandTopic.c_str());
+        LOGD(LOG_MOD_MQTT, "Subscribed to %s", commandTopic.c_str());
     } else {
-        Serial.print("failed, rc=");
-        Serial.print(client.state());
-        Serial.println(" try again in 5 seconds");
+        metrics.mqttReconnectFailures++;
+        LOGW(LOG_MOD_MQTT, "Connection failed, rc=%d, retrying in 5 seconds", client.state());
     }
 }
 
 void MqttManager::publishTelemetry(const char* payload) {
+    TRACE_SCOPE("mqtt.publish", "net");
     String topic = "sensors/" + String(config.sensorId) + "/telemetry";
     publishRaw(topic.c_str(), payload);
 }
 
+// Streamed, so duty-cycle batches are not limited by MQTT_BUFFER_SIZE
+bool MqttManager::publishBatch(const String& payload) {
+    if (!config.mqttEnabled || !client.connected()) return false;
+    String topic = "sensors/" + String(config.sensorId) + "/batch";
+    if (!client.beginPublish(topic.c_str(), payload.length(), false)) return false;
+    client.write((const uint8_t*)payload.c_str(), payload.length());
+    return client.endPublish();
+}
+
+bool MqttManager::publishEvent(const char* payload) {
+    if (!config.mqttEnabled || !client.connected()) return false;
+    String topic = "sensors/" + String(config.sensorId) + "/event";
+    return client.publish(topic.c_str(), payload);
+}
+
+// Clean disconnect, so the broker keeps this status instead of firing the will
+void MqttManager::disconnect(const char* status) {
+    if (!client.connected()) return;
+    publishStatus(status);
+    client.disconnect();
+    _connected = false;
+}
+
 void MqttManager::publishStatus(const char* status) {
     String topic = "sensors/" + String(config.sensorId) + "/status";
     publishRaw(topic.c_str(), status, true);
@@ -101,13 +163,9 @@ void MqttManager::internalCallback(char* topic, byte* payload, unsigned int leng
         payloadStr += (char)payload[i];
     }
     
-    Serial.printf("MQTT Message [%s]: %s\n", topic, payloadStr.c_str());
+    LOGD(LOG_MOD_MQTT, "Message [%s]: %s", topic, payloadStr.c_str());
     
     if (_commandCallback) {
         _commandCallback(String(topic), payloadStr);
     }
 }
-
-bool MqttManager::isConnected() {
-    return client.connected();
-}
\ No newline at end of file
@@ -6,6 +6,10 @@
 #include <WiFiClient.h>
 #include "config.h"
 #include <functional>
+#include <atomic>
+
+// PubSubClient defaults to 256 bytes, too small for telemetry and the boot report
+#define MQTT_BUFFER_SIZE 1024
 
 class MqttManager {
 public:
@@ -13,12 +17,18 @@ public:
 
     MqttManager();
     void begin();
+    void reconfigure();
     void loop();
     void publishTelemetry(const char* payload);
     void publishStatus(const char* status);
     void publishRaw(const char* topic, const char* payload, bool retained = false);
+    bool publishBatch(const String& payload);
+    bool publishEvent(const char* payload);
+    void disconnect(const char* status);
     void setCommandCallback(CommandCallback cb);
-    bool isConnected();
+    // Session state as of the last loop(); safe from any task, unlike PubSubClient::connected(),
+    // which stop()s the socket when it finds it dead
+    bool isConnected() const { return _connected.load(std::memory_order_relaxed); }
 
 private:
     WiFiClient espClient;
@@ -26,6 +36,8 @@ private:
     PubSubClient client;
     long lastReconnectAttempt;
     CommandCallback _commandCallback;
+    char _connectedSensorId[sizeof(Config::sensorId)];
+    std::atomic<bool> _connected;
     
     void reconnect();
     void internalCallback(char* topic, byte* payload, unsigned int length);
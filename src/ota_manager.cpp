@@ -1,5 +1,7 @@
 #include "ota_manager.h"
 #include "logging.h"
+#include "config.h"
+#include "scheduler.h"
 #if defined(ESP8266)
 #include <ESP8266HTTPClient.h>
 #include <ESP8266WiFi.h>
@@ -10,14 +12,19 @@
 #include <Update.h>
 #endif
 
-extern Logger logger;
-
+int OtaManager::_task = -1;
 bool OtaManager::_updatePending = false;
 String OtaManager::_updateUrl = "";
 
+void OtaManager::begin() {
+    // Downloads and flashes for as long as it takes, so no budget
+    _task = Scheduler::add("ota", SCHED_EVENT, 0, loop);
+}
+
 void OtaManager::triggerUpdate(const char* url) {
     _updateUrl = String(url);
     _updatePending = true;
+    Scheduler::signal(_task);
 }
 
 void OtaManager::loop() {
@@ -28,8 +35,8 @@ void OtaManager::loop() {
 }
 
 void OtaManager::performUpdate(String url) {
-    logger.log("OTA: Starting update from " + url);
-    Serial.println("OTA: Starting update...");
+    LOGI(LOG_MOD_OTA, "Starting update from %s", url.c_str());
+    logger.flush();
 
     HTTPClient http;
     WiFiClient client;
@@ -44,18 +51,21 @@ void OtaManager::performUpdate(String url) {
 
     int httpCode = http.GET();
     if (httpCode != HTTP_CODE_OK) {
-        logger.log("OTA: HTTP GET failed, code: " + String(httpCode));
+        LOGE(LOG_MOD_OTA, "HTTP GET failed, code: %d", httpCode);
         http.end();
         return;
     }
 
     int contentLength = http.getSize();
     if (contentLength <= 0) {
-        logger.log("OTA: Invalid content length");
+        LOGE(LOG_MOD_OTA, "Invalid content length");
         http.end();
         return;
     }
 
+    // The new firmware migrates from config.json if its schema differs
+    config.exportJson();
+
     bool canBegin = false;
     #ifdef ESP32
     canBegin = Update.begin(contentLength, U_FLASH);
@@ -68,26 +78,26 @@ void OtaManager::performUpdate(String url) {
         size_t written = Update.writeStream(*stream);
 
         if (written == (size_t)contentLength) {
-            Serial.println("OTA: Written " + String(written) + " successfully");
+            LOGI(LOG_MOD_OTA, "Written %u successfully", (unsigned)written);
         } else {
-            Serial.println("OTA: Written only " + String(written) + "/" + String(contentLength));
+            LOGW(LOG_MOD_OTA, "Written only %u/%d", (unsigned)written, contentLength);
         }
 
         if (Update.end()) {
-            Serial.println("OTA: Update finished!");
+            LOGI(LOG_MOD_OTA, "Update finished");
             if (Update.isFinished()) {
-                logger.log("OTA: Success. Rebooting.");
-                Serial.println("OTA: Success. Rebooting.");
+                LOGI(LOG_MOD_OTA, "Success. Rebooting.");
+                logger.flush();
                 delay(1000);
                 ESP.restart();
             } else {
-                logger.log("OTA: Not finished?");
+                LOGE(LOG_MOD_OTA, "Update not finished");
             }
         } else {
-            logger.log("OTA: Error occurred #: " + String(Update.getError()));
+            LOGE(LOG_MOD_OTA, "Error occurred #: %d", (int)Update.getError());
         }
     } else {
-        logger.log("OTA: Not enough space");
+        LOGE(LOG_MOD_OTA, "Not enough space");
     }
 
     http.end();
@@ -5,10 +5,12 @@
 
 class OtaManager {
 public:
+    static void begin(); // Registers the update as an event task
     static void triggerUpdate(const char* url);
     static void loop();
 
 private:
+    static int _task;
     static bool _updatePending;
     static String _updateUrl;
     static void performUpdate(String url);
@@ -0,0 +1,201 @@
+#include "pipeline.h"
+
+#ifdef CALID_PIPELINE
+#include "config.h"
+#include "sensor.h"
+#include "telemetry.h"
+#include "mqtt_manager.h"
+#include "history_store.h"
+#include "metrics.h"
+#include "boot_profile.h"
+#include "logging.h"
+#include <WiFi.h>
+
+bool Pipeline::_running = false;
+PipelineTask Pipeline::_acq = { "acquire", nullptr, PIPELINE_ACQ_CORE, PIPELINE_ACQ_PRIORITY, {0}, 0 };
+PipelineTask Pipeline::_proc = { "process", nullptr, PIPELINE_PROC_CORE, PIPELINE_PROC_PRIORITY, {0}, 0 };
+PipelineTask Pipeline::_net = { "transport", nullptr, PIPELINE_NET_CORE, PIPELINE_NET_PRIORITY, {0}, 0 };
+TaskHandle_t Pipeline::_loopTask = nullptr;
+SemaphoreHandle_t Pipeline::_sensorMutex = nullptr;
+SemaphoreHandle_t Pipeline::_mqttMutex = nullptr;
+SpscRing<SampleFrame*, PIPELINE_SAMPLE_SLOTS> Pipeline::_samples;
+SpscRing<OutboundMessage*, PIPELINE_OUTBOX_SLOTS> Pipeline::_outbox;
+
+void PipelineTask::addBusy(uint32_t us) {
+    busyUsCarry += us;
+    if (busyUsCarry >= 1000) {
+        busyMs.fetch_add(busyUsCarry / 1000, std::memory_order_relaxed);
+        busyUsCarry %= 1000;
+    }
+}
+
+void Pipeline::start(PipelineTask& task, TaskFunction_t fn, uint32_t stack) {
+    if (xTaskCreatePinnedToCore(fn, task.name, stack, &task, task.priority, &task.handle, task.core) != pdPASS) {
+        LOGE(LOG_MOD_SYSTEM, "Failed to start %s task", task.name);
+        task.handle = nullptr;
+    }
+}
+
+void Pipeline::begin() {
+    _loopTask = xTaskGetCurrentTaskHandle();
+    _sensorMutex = xSemaphoreCreateMutex();
+    _mqttMutex = xSemaphoreCreateMutex();
+
+    // Consumers first so the first notification is not lost
+    start(_net, transportTask, PIPELINE_NET_STACK);
+    start(_proc, processingTask, PIPELINE_PROC_STACK);
+    start(_acq, acquisitionTask, PIPELINE_ACQ_STACK);
+    _running = _acq.handle && _proc.handle && _net.handle;
+    LOGI(LOG_MOD_SYSTEM, "Pipeline %s", _running ? "started" : "incomplete");
+}
+
+// Ticks on a fixed micros() schedule so sample spacing does not depend on how long
+// encoding or publishing took; driver init steps fill the gaps. Each tick samples
+// whatever slots are due.
+void Pipeline::acquisitionTask(void* arg) {
+    PipelineTask& self = *(PipelineTask*)arg;
+    const uint32_t periodUs = SENSOR_TICK_MS * 1000UL;
+    uint32_t nextUs = micros();
+
+    for (;;) {
+        uint32_t start = micros();
+        int32_t late = start - nextUs;
+
+        if (late >= 0) {
+            metrics.sampleJitter.observe(late);
+            bool sampled;
+            {
+                SensorLock lock;
+                sampled = acquireSample();
+            }
+            if (sampled) {
+                SampleFrame* frame = new SampleFrame();
+                frame->snapshot = sensorSnapshot();
+                frame->sampledAtMs = millis();
+
+                if (_samples.push(frame)) {
+                    xTaskNotifyGive(_proc.handle);
+                } else {
+                    delete frame;
+                    metrics.pipelineDropped++;
+                }
+            }
+
+            nextUs += periodUs;
+            // Fell more than a period behind (e.g. a long init step): re-anchor
+            if ((int32_t)(micros() - nextUs) > 0) nextUs = micros() + periodUs;
+        } else if (!config.testingMode) {
+            SensorLock lock;
+            sensor.loop();
+        }
+        self.addBusy(micros() - start);
+
+        int32_t waitMs = (int32_t)(nextUs - micros()) / 1000;
+        if (waitMs > PIPELINE_INIT_STEP_MS) waitMs = PIPELINE_INIT_STEP_MS;
+        vTaskDelay(waitMs > 0 ? pdMS_TO_TICKS(waitMs) : 1);
+    }
+}
+
+void Pipeline::processingTask(void* arg) {
+    PipelineTask& self = *(PipelineTask*)arg;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+
+        SampleFrame* frame;
+        while (_samples.pop(frame)) {
+            uint32_t start = micros();
+            const SensorReadings* data = frame->snapshot->data.data();
+            int count = frame->snapshot->data.size();
+
+            historyStore.append(data, count);
+
+            OutboundMessage* msg = new OutboundMessage();
+            msg->sampledAtMs = frame->sampledAtMs;
+            if (config.mqttEnabled) msg->mqttPayload = encodeMqttTelemetry(data, count);
+            if (strlen(config.apiEndpoint) > 0) {
+                msg->httpPayload = encodeHttpUpload(data, count);
+            }
+            delete frame;
+
+            if (!msg->mqttPayload.length() && !msg->httpPayload.length()) {
+                delete msg; // Nothing read this tick made it into a payload
+            } else if (_outbox.push(msg)) {
+                xTaskNotifyGive(_net.handle);
+            } else {
+                delete msg;
+                metrics.pipelineDropped++;
+            }
+            self.addBusy(micros() - start);
+        }
+    }
+}
+
+// Owns the MQTT client: keepalive, commands, heartbeat and publishing all happen here
+void Pipeline::transportTask(void* arg) {
+    PipelineTask& self = *(PipelineTask*)arg;
+    uint32_t lastHeartbeat = 0;
+    bool heartbeatSent = false;
+
+    for (;;) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(PIPELINE_NET_POLL_MS));
+        uint32_t start = micros();
+
+        {
+            MqttLock lock;
+            mqttManager.loop();
+            if (mqttManager.isConnected() && (!heartbeatSent || millis() - lastHeartbeat > HEARTBEAT_INTERVAL_MS)) {
+                mqttManager.publishStatus("online");
+                lastHeartbeat = millis();
+                heartbeatSent = true;
+            }
+        }
+
+        OutboundMessage* msg;
+        while (_outbox.pop(msg)) {
+            if (msg->mqttPayload.length()) {
+                MqttLock lock;
+                if (mqttManager.isConnected()) {
+                    MetricsTimer publishTimer(metrics.mqttPublish);
+                    mqttManager.publishTelemetry(msg->mqttPayload.c_str());
+                    BootProfile::mark("first_sample");
+                }
+            }
+            if (msg->httpPayload.length() && WiFi.status() == WL_CONNECTED) {
+                if (postHttpUpload(msg->httpPayload) > 0) BootProfile::mark("first_sample");
+            }
+            metrics.pipelineLatency.observe((millis() - msg->sampledAtMs) * 1000);
+            delete msg;
+        }
+        self.addBusy(micros() - start);
+    }
+}
+
+void Pipeline::toJson(JsonArray tasks) {
+    uint32_t uptimeMs = millis();
+    const PipelineTask* all[] = { &_acq, &_proc, &_net };
+    for (const PipelineTask* t : all) {
+        if (!t->handle) continue;
+        JsonObject o = tasks.add<JsonObject>();
+        uint32_t busy = t->busyMs.load(std::memory_order_relaxed);
+        o["name"] = t->name;
+        o["core"] = t->core;
+        o["priority"] = t->priority;
+        o["stackFree"] = uxTaskGetStackHighWaterMark(t->handle);
+        o["cpuMs"] = busy;
+        o["cpuPct"] = uptimeMs ? busy * 100.0f / uptimeMs : 0;
+    }
+
+    if (_loopTask) {
+        uint32_t busy = metrics.loopIteration.sumMicros() / 1000;
+        JsonObject o = tasks.add<JsonObject>();
+        o["name"] = "loop";
+        o["core"] = xTaskGetAffinity(_loopTask);
+        o["priority"] = uxTaskPriorityGet(_loopTask);
+        o["stackFree"] = uxTaskGetStackHighWaterMark(_loopTask);
+        o["cpuMs"] = busy;
+        o["cpuPct"] = uptimeMs ? busy * 100.0f / uptimeMs : 0;
+    }
+}
+
+#endif
@@ -0,0 +1,132 @@
+#ifndef CALID_PIPELINE_H
+#define CALID_PIPELINE_H
+
+#include <Arduino.h>
+
+// On ESP32, sampling, encoding and network I/O run as separate FreeRTOS tasks.
+// ESP8266 (or -D CALID_NO_PIPELINE) keeps everything in loop().
+#if defined(ESP32) && !defined(CALID_NO_PIPELINE)
+#define CALID_PIPELINE
+#endif
+
+#ifdef CALID_PIPELINE
+#include <ArduinoJson.h>
+#include <atomic>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include "spsc_ring.h"
+#include "sensor.h"
+
+// Sampling and encoding share the app core with loop(); network I/O sits on core 0
+// next to the WiFi/lwIP tasks, so a stalled socket never delays a sample.
+#if CONFIG_FREERTOS_UNICORE
+#define PIPELINE_APP_CORE 0
+#else
+#define PIPELINE_APP_CORE 1
+#endif
+#define PIPELINE_ACQ_PRIORITY 3
+#define PIPELINE_ACQ_CORE PIPELINE_APP_CORE
+#define PIPELINE_ACQ_STACK 4096
+#define PIPELINE_PROC_PRIORITY 2
+#define PIPELINE_PROC_CORE PIPELINE_APP_CORE
+#define PIPELINE_PROC_STACK 6144
+#define PIPELINE_NET_PRIORITY 1
+#define PIPELINE_NET_CORE 0
+#define PIPELINE_NET_STACK 10240 // TLS handshakes for MQTT/HTTPS
+
+#define PIPELINE_SAMPLE_SLOTS 4
+#define PIPELINE_OUTBOX_SLOTS 8
+#define PIPELINE_INIT_STEP_MS 100 // Sensor init state machine cadence between samples
+#define PIPELINE_NET_POLL_MS 50   // MQTT keepalive/command polling
+
+struct SampleFrame {
+    uint32_t sampledAtMs;
+    SensorSnapshotRef snapshot;
+};
+
+struct OutboundMessage {
+    uint32_t sampledAtMs;
+    String mqttPayload;
+    String httpPayload;
+};
+
+struct PipelineTask {
+    const char* name;
+    TaskHandle_t handle;
+    uint8_t core;
+    uint8_t priority;
+    std::atomic<uint32_t> busyMs; // Time spent working, excludes blocking waits
+    uint32_t busyUsCarry;         // Sub-millisecond remainder, owned by the task itself
+
+    void addBusy(uint32_t us);
+};
+
+class Pipeline {
+public:
+    // Starts the tasks; call last in setup(). loop() then only serves the web UI,
+    // OTA, config reloads and NTP.
+    static void begin();
+    static bool running() { return _running; }
+
+    // name, core, priority, stack headroom and CPU time per task, plus loop()
+    static void toJson(JsonArray tasks);
+
+    static void lockSensors() { if (_sensorMutex) xSemaphoreTake(_sensorMutex, portMAX_DELAY); }
+    static void unlockSensors() { if (_sensorMutex) xSemaphoreGive(_sensorMutex); }
+    static void lockMqtt() { if (_mqttMutex) xSemaphoreTake(_mqttMutex, portMAX_DELAY); }
+    static void unlockMqtt() { if (_mqttMutex) xSemaphoreGive(_mqttMutex); }
+    static bool tryLockMqtt(uint32_t waitMs) { return !_mqttMutex || xSemaphoreTake(_mqttMutex, pdMS_TO_TICKS(waitMs)) == pdTRUE; }
+
+private:
+    static bool _running;
+    static PipelineTask _acq;
+    static PipelineTask _proc;
+    static PipelineTask _net;
+    static TaskHandle_t _loopTask;
+    static SemaphoreHandle_t _sensorMutex;
+    static SemaphoreHandle_t _mqttMutex;
+    static SpscRing<SampleFrame*, PIPELINE_SAMPLE_SLOTS> _samples;
+    static SpscRing<OutboundMessage*, PIPELINE_OUTBOX_SLOTS> _outbox;
+
+    static void acquisitionTask(void* arg);
+    static void processingTask(void* arg);
+    static void transportTask(void* arg);
+    static void start(PipelineTask& task, TaskFunction_t fn, uint32_t stack);
+};
+
+#else
+
+class Pipeline {
+public:
+    static void begin() {}
+    static bool running() { return false; }
+    static void lockSensors() {}
+    static void unlockSensors() {}
+    static void lockMqtt() {}
+    static void unlockMqtt() {}
+    static bool tryLockMqtt(uint32_t) { return true; }
+};
+
+#endif
+
+// Scoped holds on state that loop() shares with the pipeline tasks: the sensor
+// drivers/allSensorData and the MQTT client. No-ops without the pipeline.
+class SensorLock {
+public:
+    SensorLock() { Pipeline::lockSensors(); }
+    ~SensorLock() { Pipeline::unlockSensors(); }
+};
+
+class MqttLock {
+public:
+    MqttLock() : _held(true) { Pipeline::lockMqtt(); }
+    // Gives up after waitMs, e.g. while the transport task sits in a reconnect
+    explicit MqttLock(uint32_t waitMs) : _held(Pipeline::tryLockMqtt(waitMs)) {}
+    ~MqttLock() { if (_held) Pipeline::unlockMqtt(); }
+    bool held() const { return _held; }
+private:
+    bool _held;
+};
+
+#endif
@@ -0,0 +1,215 @@
+#include "power_manager.h"
+#include "config.h"
+#include "scheduler.h"
+#include "logging.h"
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <coredecls.h>
+extern "C" {
+#include <user_interface.h>
+}
+#else
+#include <WiFi.h>
+#include <esp_wifi.h>
+#include <esp_sleep.h>
+#include <driver/gpio.h>
+#include <hal/gpio_ll.h>
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+#endif
+
+uint8_t PowerManager::_mode = POWER_SLEEP_NONE;
+volatile bool PowerManager::_wake = false;
+uint32_t PowerManager::_sinceMs = 0;
+uint64_t PowerManager::_idleUs = 0;
+uint32_t PowerManager::_idles = 0;
+uint32_t PowerManager::_earlyWakes = 0;
+uint8_t PowerManager::_associatedListen = 1;
+uint32_t PowerManager::_reassociateAt = 0;
+
+#ifdef ESP32
+static TaskHandle_t loopTask = nullptr;
+#endif
+
+static const char* const modeNames[] = { "none", "modem", "light" };
+
+void PowerManager::begin() {
+    #ifdef ESP32
+    loopTask = xTaskGetCurrentTaskHandle();
+    #endif
+    _sinceMs = millis();
+    apply();
+}
+
+// Radio sleep type and the listen interval the next association will ask for
+void PowerManager::configureRadio(uint8_t mode, uint8_t listen) {
+    #ifdef ESP8266
+    static const WiFiSleepType_t types[] = { WIFI_NONE_SLEEP, WIFI_MODEM_SLEEP, WIFI_LIGHT_SLEEP };
+    if (!WiFi.setSleepMode(types[mode], listen)) {
+        LOGW(LOG_MOD_WIFI, "Could not set WiFi sleep mode %s", modeNames[mode]);
+    }
+    #else
+    // Only max modem sleep honours the listen interval; min wakes for every DTIM
+    WiFi.setSleep(mode == POWER_SLEEP_NONE ? WIFI_PS_NONE : (listen > 1 ? WIFI_PS_MAX_MODEM : WIFI_PS_MIN_MODEM));
+    wifi_config_t conf;
+    if (esp_wifi_get_config(WIFI_IF_STA, &conf) == ESP_OK && conf.sta.listen_interval != listen) {
+        conf.sta.listen_interval = listen;
+        esp_wifi_set_config(WIFI_IF_STA, &conf);
+    }
+    #endif
+}
+
+void PowerManager::configureAssociation() {
+    uint8_t mode = config.wifiSleep > POWER_SLEEP_LIGHT ? POWER_SLEEP_LIGHT : config.wifiSleep;
+    uint8_t listen = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+    configureRadio(mode, listen);
+    _associatedListen = listen;
+}
+
+void PowerManager::apply() {
+    uint8_t mode = config.wifiSleep > POWER_SLEEP_LIGHT ? POWER_SLEEP_LIGHT : config.wifiSleep;
+    uint8_t listen = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+
+    configureRadio(mode, listen);
+    #ifdef ESP32
+    #if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t pm = {};
+    pm.max_freq_mhz = getCpuFrequencyMhz();
+    pm.min_freq_mhz = mode == POWER_SLEEP_NONE ? pm.max_freq_mhz : 40;
+    pm.light_sleep_enable = mode == POWER_SLEEP_LIGHT;
+    if (esp_pm_configure(&pm) != ESP_OK) {
+        LOGW(LOG_MOD_WIFI, "Power management rejected, light sleep unavailable");
+        if (mode == POWER_SLEEP_LIGHT) mode = POWER_SLEEP_MODEM;
+    }
+    #else
+    // Stock Arduino-ESP32 builds have no tickless idle; idling still gates the CPU clock
+    if (mode == POWER_SLEEP_LIGHT) {
+        LOGW(LOG_MOD_WIFI, "Light sleep needs CONFIG_PM_ENABLE, using modem sleep");
+        mode = POWER_SLEEP_MODEM;
+    }
+    #endif
+    #endif
+
+    _mode = mode;
+    LOGI(LOG_MOD_WIFI, "WiFi sleep %s, listen interval %u", modeNames[mode], listen);
+
+    // Without power save the radio hears every beacon whatever was negotiated
+    if (mode != POWER_SLEEP_NONE && listen != _associatedListen && WiFi.status() == WL_CONNECTED) {
+        LOGI(LOG_MOD_WIFI, "Reconnecting so the AP picks up listen interval %u", listen);
+        _reassociateAt = millis() + POWER_REASSOCIATE_DELAY_MS;
+        if (!_reassociateAt) _reassociateAt = 1;
+    } else {
+        _reassociateAt = 0;
+    }
+}
+
+void PowerManager::idle() {
+    if (_reassociateAt && (int32_t)(millis() - _reassociateAt) >= 0) {
+        _reassociateAt = 0;
+        _associatedListen = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+        WiFi.reconnect();
+    }
+    if (_mode == POWER_SLEEP_NONE) return;
+
+    // Cleared before looking at the schedule, so a signal in between is not lost
+    _wake = false;
+    uint32_t ms = Scheduler::idleMs();
+    uint32_t cap = _mode == POWER_SLEEP_LIGHT ? POWER_LIGHT_IDLE_MS : POWER_MODEM_IDLE_MS;
+    if (ms > cap) ms = cap;
+    if (ms == 0) return;
+
+    uint32_t start = micros();
+    #ifdef ESP32
+    ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(ms));
+    #else
+    esp_delay(ms, []() { return !_wake; });
+    #endif
+    uint32_t us = micros() - start;
+
+    _idleUs += us;
+    _idles++;
+    if (_wake) _earlyWakes++;
+}
+
+void PowerManager::wake() {
+    _wake = true;
+    #ifdef ESP32
+    if (loopTask) xTaskNotifyGive(loopTask);
+    #else
+    esp_schedule();
+    #endif
+}
+
+void IRAM_ATTR PowerManager::wakeFromIsr() {
+    _wake = true;
+    #ifdef ESP32
+    if (!loopTask) return;
+    BaseType_t woken = pdFALSE;
+    vTaskNotifyGiveFromISR(loopTask, &woken);
+    if (woken) portYIELD_FROM_ISR();
+    #else
+    esp_schedule();
+    #endif
+}
+
+void IRAM_ATTR PowerManager::wakeOnPin(uint8_t pin, bool level) {
+    #ifdef ESP8266
+    // Same bits wifi_enable_gpio_wakeup() sets, written directly so an ISR can re-arm
+    GPC(pin) = (GPC(pin) & ~(0xF << GPCI)) | ((level ? ONHIGH : ONLOW) << GPCI) | (1 << GPCWE);
+    #else
+    static bool enabled = false;
+    if (!enabled && !xPortInIsrContext()) {
+        esp_sleep_enable_gpio_wakeup();
+        enabled = true;
+    }
+    gpio_ll_wakeup_enable(&GPIO, (gpio_num_t)pin, level ? GPIO_INTR_HIGH_LEVEL : GPIO_INTR_LOW_LEVEL);
+    #endif
+}
+
+void PowerManager::clearWakeOnPin(uint8_t pin) {
+    #ifdef ESP8266
+    GPC(pin) &= ~(1 << GPCWE);
+    #else
+    gpio_wakeup_disable((gpio_num_t)pin);
+    #endif
+}
+
+uint32_t PowerManager::maxExtraLatencyMs() {
+    if (_mode == POWER_SLEEP_NONE) return 0;
+    uint32_t cap = _mode == POWER_SLEEP_LIGHT ? POWER_LIGHT_IDLE_MS : POWER_MODEM_IDLE_MS;
+    uint8_t listen = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+    return cap + (uint32_t)(listen * POWER_BEACON_MS);
+}
+
+// Idle draw including the radio waking to listen for beacons
+float PowerManager::idleMa(uint8_t mode) {
+    if (mode == POWER_SLEEP_NONE) return POWER_ACTIVE_MA;
+    uint8_t listen = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+    float base = mode == POWER_SLEEP_LIGHT ? POWER_LIGHT_MA : POWER_MODEM_MA;
+    float rxShare = POWER_BEACON_RX_MS / (listen * POWER_BEACON_MS);
+    return base + (POWER_ACTIVE_MA - base) * rxShare;
+}
+
+void PowerManager::toJson(JsonObject obj) {
+    obj["mode"] = modeNames[_mode];
+    obj["listenInterval"] = constrain(config.listenInterval, 1, POWER_MAX_LISTEN_INTERVAL);
+    obj["associatedListenInterval"] = _associatedListen;
+    obj["maxExtraLatencyMs"] = maxExtraLatencyMs();
+    obj["idles"] = _idles;
+    obj["earlyWakes"] = _earlyWakes;
+
+    uint64_t elapsedUs = (uint64_t)(millis() - _sinceMs) * 1000;
+    obj["idlePct"] = elapsedUs ? min(1.0f, (float)_idleUs / elapsedUs) * 100 : 0;
+
+    // Work share of the loop is the same whatever the mode, so each mode can be
+    // priced from it before switching
+    uint64_t uptimeUs = (uint64_t)millis() * 1000;
+    float busyShare = uptimeUs ? min(1.0f, (float)Scheduler::busyUs() / uptimeUs) : 1;
+    obj["busyPct"] = busyShare * 100;
+    JsonObject est = obj["estimatedMa"].to<JsonObject>();
+    for (uint8_t m = POWER_SLEEP_NONE; m <= POWER_SLEEP_LIGHT; m++) {
+        est[modeNames[m]] = busyShare * POWER_ACTIVE_MA + (1 - busyShare) * idleMa(m);
+    }
+    obj["currentMa"] = busyShare * POWER_ACTIVE_MA + (1 - busyShare) * idleMa(_mode);
+}
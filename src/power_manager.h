@@ -0,0 +1,74 @@
+#ifndef CALID_POWER_MANAGER_H
+#define CALID_POWER_MANAGER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+enum PowerSleep {
+    POWER_SLEEP_NONE = 0, // Radio and CPU always on, loop() spins
+    POWER_SLEEP_MODEM,    // Radio off between beacons, CPU idles between tasks
+    POWER_SLEEP_LIGHT     // CPU and radio suspended between tasks
+};
+
+// Longest stretch between passes over the polled tasks (web, MQTT, sensors).
+// Together with the beacon interval this bounds the extra latency sleep adds.
+#define POWER_MODEM_IDLE_MS 50
+#define POWER_LIGHT_IDLE_MS 100
+#define POWER_MAX_LISTEN_INTERVAL 10 // Beacons; keeps the worst case near 1 s
+#define POWER_REASSOCIATE_DELAY_MS 1000 // Lets the config save response out before the link drops
+
+// Typical supply current per state, from the datasheets. Combined with the
+// measured split between work and idle to estimate the average draw.
+#if defined(ESP8266)
+#define POWER_ACTIVE_MA 70.0f
+#define POWER_MODEM_MA 15.0f
+#define POWER_LIGHT_MA 0.9f
+#else
+#define POWER_ACTIVE_MA 95.0f
+#define POWER_MODEM_MA 30.0f
+#define POWER_LIGHT_MA 0.8f
+#endif
+#define POWER_BEACON_MS 102.4f
+#define POWER_BEACON_RX_MS 3.0f // Radio on per listened beacon
+
+// WiFi power save plus idling the loop between scheduled tasks. The loop sleeps
+// until the next task is due, a task is signalled or the poll cap runs out;
+// the SDK turns that idle time into modem or automatic light sleep.
+class PowerManager {
+public:
+    static void begin(); // Once WiFi is up, from the loop task
+    // Re-reads config.wifiSleep / config.listenInterval. The AP only learns a new
+    // listen interval from an association request, so a change reconnects WiFi.
+    static void apply();
+    // Sets the sleep type and listen interval ahead of connecting, so the first
+    // association already carries them; call right before the station connects
+    static void configureAssociation();
+
+    static void idle();       // Call at the end of each scheduler pass
+    static void wake();       // Cuts idle() short; from other tasks
+    static void wakeFromIsr();
+    // Lets a GPIO level pull the chip out of light sleep. This makes the pin's
+    // interrupt level-triggered too, so its handler must re-arm for the opposite
+    // level on every call; safe from an ISR.
+    static void wakeOnPin(uint8_t pin, bool level);
+    static void clearWakeOnPin(uint8_t pin);
+
+    static uint8_t mode() { return _mode; }
+    static uint32_t maxExtraLatencyMs();
+    static void toJson(JsonObject obj);
+
+private:
+    static uint8_t _mode;
+    static volatile bool _wake;
+    static uint32_t _sinceMs;
+    static uint64_t _idleUs;
+    static uint32_t _idles;
+    static uint32_t _earlyWakes;
+    static uint8_t _associatedListen; // Listen interval the current association was made with
+    static uint32_t _reassociateAt;   // 0 when none is pending
+
+    static void configureRadio(uint8_t mode, uint8_t listen);
+    static float idleMa(uint8_t mode);
+};
+
+#endif
@@ -0,0 +1,189 @@
+#include "scheduler.h"
+#include "metrics.h"
+#include "logging.h"
+#include "power_manager.h"
+#include <Ticker.h>
+
+#define SCHED_STALL_MAGIC 0x5354 // "ST"
+
+// Last stall, kept in RTC memory so a watchdog reset can still be attributed
+struct StallRecord {
+    uint16_t magic;
+    uint8_t task;
+    uint8_t reserved;
+    uint32_t stalledMs;
+};
+
+#ifdef ESP32
+RTC_NOINIT_ATTR static StallRecord rtcStall;
+#else
+static_assert(SCHED_RTC_OFFSET * 4 + sizeof(StallRecord) <= 512, "StallRecord overflows RTC user memory");
+#endif
+
+SchedTask Scheduler::_tasks[SCHED_MAX_TASKS];
+uint8_t Scheduler::_count = 0;
+volatile int8_t Scheduler::_current = -1;
+volatile uint32_t Scheduler::_currentSince = 0;
+volatile bool Scheduler::_stallReported = false;
+uint32_t Scheduler::_lateMs = 0;
+uint64_t Scheduler::_busyUs = 0;
+
+static Ticker watchdogTicker;
+
+static void writeStall(const StallRecord& r) {
+    #ifdef ESP32
+    rtcStall = r;
+    #else
+    ESP.rtcUserMemoryWrite(SCHED_RTC_OFFSET, (uint32_t*)&r, sizeof(r));
+    #endif
+}
+
+static void saveStall(int task, uint32_t stalledMs) {
+    StallRecord r = { SCHED_STALL_MAGIC, (uint8_t)task, 0, stalledMs };
+    writeStall(r);
+}
+
+#ifdef ESP8266
+// Called by the core's postmortem, including for soft WDT resets that the ticker never saw
+extern "C" void custom_crash_callback(struct rst_info*, uint32_t, uint32_t) {
+    int task = Scheduler::current();
+    if (task >= 0) saveStall(task, Scheduler::currentMs());
+}
+#endif
+
+int Scheduler::add(const char* name, uint32_t periodMs, uint32_t budgetUs, SchedFn fn) {
+    if (_count >= SCHED_MAX_TASKS) {
+        LOGE(LOG_MOD_SYSTEM, "No scheduler slot for task '%s'", name);
+        return -1;
+    }
+    SchedTask& t = _tasks[_count];
+    t.name = name;
+    t.fn = fn;
+    t.periodMs = periodMs;
+    t.budgetUs = budgetUs;
+    t.nextAt = millis();
+    return _count++;
+}
+
+void Scheduler::signal(int task) {
+    if (task < 0 || task >= _count) return;
+    _tasks[task].signalled = true;
+    PowerManager::wake();
+}
+
+void IRAM_ATTR Scheduler::signalFromIsr(int task) {
+    if (task < 0 || task >= _count) return;
+    _tasks[task].signalled = true;
+    PowerManager::wakeFromIsr();
+}
+
+void Scheduler::begin() {
+    StallRecord r;
+    #ifdef ESP32
+    r = rtcStall;
+    #else
+    ESP.rtcUserMemoryRead(SCHED_RTC_OFFSET, (uint32_t*)&r, sizeof(r));
+    #endif
+    if (r.magic == SCHED_STALL_MAGIC) {
+        LOGW(LOG_MOD_SYSTEM, "Previous boot was reset while stalled %lu ms in task '%s'",
+             (unsigned long)r.stalledMs, r.task < _count ? _tasks[r.task].name : "?");
+        writeStall(StallRecord());
+    }
+    watchdogTicker.attach_ms(SCHED_WATCHDOG_TICK_MS, checkStall);
+}
+
+void Scheduler::run() {
+    for (uint8_t i = 0; i < _count; i++) {
+        SchedTask& t = _tasks[i];
+        uint32_t now = millis();
+        bool periodic = t.periodMs != SCHED_EVENT;
+        if (!t.signalled && !(periodic && (int32_t)(now - t.nextAt) >= 0)) continue;
+
+        t.signalled = false;
+        _lateMs = 0;
+        if (periodic) {
+            if (t.runs > 0 && (int32_t)(now - t.nextAt) > 0) _lateMs = now - t.nextAt;
+            t.nextAt += t.periodMs;
+            // More than a period behind: re-anchor instead of running back to back
+            if ((int32_t)(now - t.nextAt) >= 0) t.nextAt = now + t.periodMs;
+        }
+
+        _currentSince = now;
+        _current = i;
+        uint32_t start = micros();
+        t.fn();
+        uint32_t us = micros() - start;
+        _current = -1;
+
+        t.runs++;
+        _busyUs += us;
+        if (us > t.maxUs) t.maxUs = us;
+        if (t.budgetUs && us > t.budgetUs) {
+            t.overruns++;
+            t.lastOverrunUs = us;
+            t.lastOverrunAt = millis();
+            metrics.schedulerOverruns++;
+            // 1st, 2nd, 4th, 8th... so a task that always overruns can't flood the log
+            if ((t.overruns & (t.overruns - 1)) == 0) {
+                LOGW(LOG_MOD_SYSTEM, "Task '%s' took %lu us, budget %lu us (%lu overruns)", t.name,
+                     (unsigned long)us, (unsigned long)t.budgetUs, (unsigned long)t.overruns);
+            }
+        }
+        if (_stallReported) {
+            _stallReported = false;
+            writeStall(StallRecord());
+            LOGW(LOG_MOD_SYSTEM, "Task '%s' resumed after %lu ms", t.name, (unsigned long)(us / 1000));
+        }
+    }
+}
+
+uint32_t Scheduler::idleMs() {
+    uint32_t now = millis();
+    uint32_t slack = UINT32_MAX;
+    for (uint8_t i = 0; i < _count; i++) {
+        const SchedTask& t = _tasks[i];
+        if (t.signalled) return 0;
+        if (t.periodMs == 0 || t.periodMs == SCHED_EVENT) continue;
+        int32_t due = (int32_t)(t.nextAt - now);
+        if (due <= 0) return 0;
+        if ((uint32_t)due < slack) slack = due;
+    }
+    return slack;
+}
+
+// Runs from the ticker: the esp_timer task on ESP32, and on ESP8266 whenever the
+// stuck code yields (blocking network waits do)
+void Scheduler::checkStall() {
+    int task = _current;
+    if (task < 0 || _stallReported || _tasks[task].budgetUs == 0) return;
+    uint32_t stalledMs = millis() - _currentSince;
+    if (stalledMs < SCHED_STALL_MS) return;
+
+    _stallReported = true;
+    metrics.loopStalls++;
+    saveStall(task, stalledMs);
+    LOGE(LOG_MOD_SYSTEM, "Loop stalled %lu ms in task '%s'", (unsigned long)stalledMs, _tasks[task].name);
+}
+
+void Scheduler::toJson(JsonObject obj) {
+    obj["stalls"] = metrics.loopStalls.load();
+    int current = _current;
+    if (current >= 0) obj["current"] = _tasks[current].name;
+    JsonArray arr = obj["tasks"].to<JsonArray>();
+    uint32_t now = millis();
+    for (uint8_t i = 0; i < _count; i++) {
+        const SchedTask& t = _tasks[i];
+        JsonObject o = arr.add<JsonObject>();
+        o["name"] = t.name;
+        if (t.periodMs != SCHED_EVENT) o["periodMs"] = t.periodMs;
+        else o["event"] = true;
+        o["budgetUs"] = t.budgetUs;
+        o["runs"] = t.runs;
+        o["maxUs"] = t.maxUs;
+        o["overruns"] = t.overruns;
+        if (t.overruns) {
+            o["lastOverrunUs"] = t.lastOverrunUs;
+            o["lastOverrunAgoMs"] = now - t.lastOverrunAt;
+        }
+    }
+}
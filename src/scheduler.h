@@ -0,0 +1,73 @@
+#ifndef CALID_SCHEDULER_H
+#define CALID_SCHEDULER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "duty_cycle.h"
+
+#define SCHED_MAX_TASKS 12
+#define SCHED_EVENT 0xFFFFFFFF     // Period for tasks that only run when signalled
+#define SCHED_STALL_MS 2000        // Soft watchdog, well inside the ESP8266 soft WDT (~3 s)
+#define SCHED_WATCHDOG_TICK_MS 250
+
+// ESP8266 RTC user memory block for the stall record, after the duty-cycle buffer
+#define SCHED_RTC_OFFSET (DUTY_RTC_OFFSET + DUTY_RTC_BLOCKS)
+
+typedef void (*SchedFn)();
+
+struct SchedTask {
+    const char* name;       // Static string
+    SchedFn fn;
+    uint32_t periodMs;      // 0 runs every pass, SCHED_EVENT only when signalled
+    uint32_t budgetUs;      // 0 for work that is long by design (OTA); not policed
+    uint32_t nextAt;
+    volatile bool signalled;
+    uint32_t runs;
+    uint32_t overruns;
+    uint32_t maxUs;
+    uint32_t lastOverrunUs;
+    uint32_t lastOverrunAt;
+};
+
+// Cooperative scheduler for the Arduino loop. Every subsystem gets its own slot,
+// so one of them returning early or running long no longer skips the rest, and
+// each run is checked against its budget. A timer-driven watchdog logs the task
+// a pass is stuck in before the hardware watchdog resets the chip.
+class Scheduler {
+public:
+    static int add(const char* name, uint32_t periodMs, uint32_t budgetUs, SchedFn fn);
+    // Runs the task on the next pass, whatever its period; safe from other tasks
+    static void signal(int task);
+    static void signalFromIsr(int task);
+
+    // Starts the watchdog and reports a stall that ended the previous boot
+    static void begin();
+    // One pass over the due tasks
+    static void run();
+    // Time until the next periodic task is due, 0 if something is ready now.
+    // Tasks polled every pass (period 0) are left to the caller to bound.
+    static uint32_t idleMs();
+
+    // How late the running periodic task started against its schedule
+    static uint32_t lateMs() { return _lateMs; }
+    // Task a pass is inside (-1 between tasks) and for how long
+    static int current() { return _current; }
+    static uint32_t currentMs() { return millis() - _currentSince; }
+    // Total time spent inside tasks since boot
+    static uint64_t busyUs() { return _busyUs; }
+
+    static void toJson(JsonObject obj);
+
+private:
+    static SchedTask _tasks[SCHED_MAX_TASKS];
+    static uint8_t _count;
+    static volatile int8_t _current;
+    static volatile uint32_t _currentSince;
+    static volatile bool _stallReported;
+    static uint32_t _lateMs;
+    static uint64_t _busyUs;
+
+    static void checkStall();
+};
+
+#endif
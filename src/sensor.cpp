@@ -1,5 +1,8 @@
 #include "sensor.h"
 #include "config.h"
+#include "time_sync.h"
+#include "trace.h"
+#include "telemetry.h"
 #include "sensors/DHTSensor.h"
 #include "sensors/BME280Sensor.h"
 #include "sensors/BMP280Sensor.h"
@@ -10,105 +13,601 @@
 #include "sensors/LightProximityI2C.h"
 #include "sensors/DigitalSensor.h"
 
+#include "metrics.h"
+#include "logging.h"
+
 #include <Wire.h>
 
-SensorReadings allSensorData[MAX_SENSORS];
+std::vector<SensorReadings> allSensorData;
 int activeSensorCount = 0;
 
+static SensorSnapshotRef currentSnapshot = std::make_shared<SensorSnapshot>();
+static uint32_t snapshotGeneration = 0;
+#ifdef ESP32
+static portMUX_TYPE snapshotMux = portMUX_INITIALIZER_UNLOCKED;
+#define SNAPSHOT_LOCK() portENTER_CRITICAL(&snapshotMux)
+#define SNAPSHOT_UNLOCK() portEXIT_CRITICAL(&snapshotMux)
+#else
+#define SNAPSHOT_LOCK()
+#define SNAPSHOT_UNLOCK()
+#endif
+
+// The critical section only covers a pointer copy and a refcount bump
+SensorSnapshotRef sensorSnapshot() {
+    SNAPSHOT_LOCK();
+    SensorSnapshotRef ref = currentSnapshot;
+    SNAPSHOT_UNLOCK();
+    return ref;
+}
+
+void Sensor::publishSnapshot() {
+    auto snap = std::make_shared<SensorSnapshot>();
+    snap->takenAtMs = millis();
+    snap->data.assign(allSensorData.begin(), allSensorData.begin() + activeSensorCount);
+    if (!config.testingMode && (int)activeSlots.size() == activeSensorCount) {
+        for (uint8_t slot : activeSlots) {
+            snap->init.push_back(_init[slot]);
+            snap->health.push_back(_health[slot]);
+        }
+    }
+
+    SensorSnapshotRef previous;
+    SNAPSHOT_LOCK();
+    snap->generation = ++snapshotGeneration;
+    previous = currentSnapshot;
+    currentSnapshot = snap;
+    SNAPSHOT_UNLOCK();
+    // The old table is freed here, or by its last reader, outside the lock
+}
+
+// Channels 0-7 are on the TCA9548A at 0x70, 8-15 at 0x71 and so on; muxes share
+// the bus, so the previously used one is switched off before another is selected.
 void Sensor::selectI2CChannel(int channel) {
-    if (channel < 0 || channel > 7) return;
-    Wire.beginTransmission(0x70); // TCA9548A address
-    Wire.write(1 << channel);
+    if (channel < 0 || channel > 63) return;
+    int8_t mux = channel / 8;
+    if (_selectedMux >= 0 && _selectedMux != mux) {
+        Wire.beginTransmission(0x70 + _selectedMux);
+        Wire.write(0);
+        Wire.endTransmission();
+    }
+    Wire.beginTransmission(0x70 + mux);
+    Wire.write(1 << (channel % 8));
     Wire.endTransmission();
+    _selectedMux = mux;
+}
+
+Sensor::Sensor() : _selectedMux(-1), _i2cFailedPasses(0) {}
+
+void Sensor::configureBus() {
+    #ifdef ESP32
+    Wire.setTimeOut(config.i2cTimeoutMs);
+    #else
+    Wire.setClockStretchLimit((uint32_t)config.i2cTimeoutMs * 1000);
+    #endif
+}
+
+// A slave that lost clocks mid-byte holds SDA low until it sees the rest of them;
+// clock SCL until it lets go, issue a STOP and restart the peripheral.
+void Sensor::recoverI2CBus() {
+    metrics.i2cBusRecoveries++;
+    LOGW(LOG_MOD_SENSOR, "Resetting I2C bus (SDA %s)", digitalRead(SDA) == LOW ? "stuck low" : "high");
+
+    #ifdef ESP32
+    Wire.end();
+    #endif
+    pinMode(SDA, INPUT_PULLUP);
+    pinMode(SCL, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SCL, HIGH);
+    for (int i = 0; i < 9 && digitalRead(SDA) == LOW; i++) {
+        digitalWrite(SCL, LOW);
+        delayMicroseconds(5);
+        digitalWrite(SCL, HIGH);
+        delayMicroseconds(5);
+    }
+
+    // STOP: SDA rises while SCL is high
+    pinMode(SDA, OUTPUT_OPEN_DRAIN);
+    digitalWrite(SDA, LOW);
+    delayMicroseconds(5);
+    digitalWrite(SCL, HIGH);
+    delayMicroseconds(5);
+    digitalWrite(SDA, HIGH);
+    delayMicroseconds(5);
+
+    Wire.begin();
+    configureBus();
+    _selectedMux = -1; // Mux state is unknown after a reset
+}
+
+// Trace events keep the name pointer, so it has to outlive config edits
+static const char* traceName(const char* type) {
+    static const char* const names[] = {
+        "dht11", "dht22", "ds18b20", "bme280", "bmp280", "sht31", "lm35", "tmp36", "mq2", "mq135", "ldr",
+        "soil_moisture", "water_level", "ph_sensor", "tds_meter", "ccs811", "scd40", "bh1750", "tsl2561",
+        "vl53l0x", "pir", "relay"
+    };
+    for (const char* name : names) {
+        if (strcmp(type, name) == 0) return name;
+    }
+    return "sensor.read";
+}
+
+bool Sensor::isI2CType(const char* type) {
+    static const char* const i2cTypes[] = { "bme280", "bmp280", "sht31", "ccs811", "scd40", "bh1750", "tsl2561", "vl53l0x" };
+    for (const char* t : i2cTypes) {
+        if (strcmp(type, t) == 0) return true;
+    }
+    return false;
 }
 
-Sensor::Sensor() {}
+SensorInterface* Sensor::createDriver(const SensorConfig& cfg) {
+    String type = String(cfg.type);
+    int pin = cfg.pin;
+    int addr = cfg.i2cAddress;
+
+    // Temperature & Humidity
+    if (type == "dht11") return new DHTSensor(pin, 11);
+    if (type == "dht22") return new DHTSensor(pin, 22);
+    if (type == "ds18b20") return new DS18B20Sensor(pin, cfg.resolution);
+    if (type == "bme280") return new BME280Sensor(pin, addr);
+    if (type == "bmp280") return new BMP280Sensor(pin, addr);
+    if (type == "sht31") return new SHT31Sensor(pin, addr);
+    
+    // Analog
+    if (type == "lm35") return new AnalogSensor(pin, type, "Temperature", "C");
+    if (type == "tmp36") return new AnalogSensor(pin, type, "Temperature", "C");
+    if (type == "mq2") return new AnalogSensor(pin, type, "Smoke", "raw");
+    if (type == "mq135") return new AnalogSensor(pin, type, "Air Quality", "raw");
+    if (type == "ldr") return new AnalogSensor(pin, type, "Light", "raw");
+    if (type == "soil_moisture") return new AnalogSensor(pin, type, "Moisture", "%");
+    if (type == "water_level") return new AnalogSensor(pin, type, "Level", "raw");
+    if (type == "ph_sensor") return new AnalogSensor(pin, type, "pH", "raw");
+    if (type == "tds_meter") return new AnalogSensor(pin, type, "TDS", "ppm");
+    
+    // I2C Special
+    if (type == "ccs811" || type == "scd40") return new AirQualityI2C(pin, type, addr);
+    if (type == "bh1750" || type == "tsl2561" || type == "vl53l0x") return new LightProximityI2C(pin, type, addr);
+    
+    // Digital
+    if (type == "pir" || type == "relay") return new DigitalSensor(pin, type);
+
+    return nullptr;
+}
 
 void Sensor::begin() {
     for (auto s : sensors) {
         delete s;
     }
-    sensors.clear();
-    activeSensorCount = 0;
-
-    for (int i = 0; i < MAX_SENSORS; i++) {
-        String type = String(config.sensors[i].type);
-        int pin = config.sensors[i].pin;
-        int addr = config.sensors[i].i2cAddress;
-        int muxChannel = config.sensors[i].i2cMultiplexerChannel;
+    sensors.assign(config.sensorCount, nullptr);
+    _init.assign(config.sensorCount, SlotInit());
+    _health.assign(config.sensorCount, SlotHealth());
+    _rate.assign(config.sensorCount, SlotRate());
+    _i2cFailedPasses = 0;
+    configureBus();
+    for (int i = 0; i < config.sensorCount; i++) {
+        beginSlot(i);
+    }
+    primeSensorData();
+}
 
-        if (type == "none" || type == "") continue;
+void Sensor::beginSlot(int slot) {
+    if (slot < 0 || slot >= MAX_SENSORS) return;
+    if (slot >= (int)sensors.size()) sensors.resize(slot + 1, nullptr);
+    if (slot >= (int)_init.size()) _init.resize(slot + 1);
+    if (slot >= (int)_health.size()) _health.resize(slot + 1);
+    if (slot >= (int)_rate.size()) _rate.resize(slot + 1);
 
-        bool isI2C = (type == "bme280" || type == "bmp280" || type == "sht31" || 
-                      type == "ccs811" || type == "scd40" || type == "bh1750" || 
-                      type == "tsl2561" || type == "vl53l0x");
+    delete sensors[slot];
+    sensors[slot] = nullptr;
+    _init[slot] = SlotInit();
+    _init[slot].startedAt = millis();
+    _health[slot] = SlotHealth();
+    resetRate(slot);
 
-        if (isI2C && muxChannel >= 0) {
-            selectI2CChannel(muxChannel);
+    const SensorConfig& cfg = config.sensors[slot];
+    if (slot < config.sensorCount && strcmp(cfg.type, "none") != 0 && cfg.type[0] != '\0') {
+        if (ESP.getFreeHeap() < SENSOR_MIN_FREE_HEAP) {
+            LOGE(LOG_MOD_SENSOR, "Slot %d (%s) skipped: free heap %u below budget", slot, cfg.type, (unsigned)ESP.getFreeHeap());
+        } else {
+            sensors[slot] = createDriver(cfg);
         }
+    }
+
+    // Drop trailing empty slots left behind by a shrinking table
+    while (!sensors.empty() && !sensors.back() && (int)sensors.size() > config.sensorCount) {
+        sensors.pop_back();
+    }
+    _init.resize(sensors.size());
+    _health.resize(sensors.size());
+    _rate.resize(sensors.size());
+    primeSensorData();
+}
+
+void Sensor::primeSensorData() {
+    activeSlots.clear();
+    for (int i = 0; i < (int)sensors.size(); i++) {
+        if (sensors[i]) activeSlots.push_back(i);
+    }
+
+    allSensorData.resize(activeSlots.size());
+    for (size_t n = 0; n < activeSlots.size(); n++) {
+        const SensorConfig& cfg = config.sensors[activeSlots[n]];
+        allSensorData[n].pin = cfg.pin;
+        allSensorData[n].sensorType = cfg.type;
+        allSensorData[n].valid = false;
+        allSensorData[n].readings.clear();
+        allSensorData[n].error = _init[activeSlots[n]].state == SLOT_INITIALIZING ? "initializing" : "failed";
+    }
+    activeSensorCount = activeSlots.size();
+    publishSnapshot();
+}
+
+void Sensor::readSlot(int slot, SensorReadings& out) {
+    const SensorConfig& cfg = config.sensors[slot];
+    if (cfg.i2cMultiplexerChannel >= 0 && isI2CType(cfg.type)) {
+        selectI2CChannel(cfg.i2cMultiplexerChannel);
+    }
+
+    {
+        MetricsTimer readTimer(metrics.sensorRead);
+        out = sensors[slot]->read();
+    }
+    out.timestampMs = TimeSync::nowMs();
+
+    // Apply Offsets
+    for (auto& r : out.readings) {
+        if (r.type == "Temperature") r.value += cfg.tempOffset;
+        if (r.type == "Humidity") r.value += cfg.humOffset;
+    }
+}
+
+void Sensor::failSlot(int slot, const char* reason) {
+    SlotInit& st = _init[slot];
+    if (st.attempts < 255) st.attempts++;
+    uint32_t backoff = SENSOR_INIT_RETRY_MS;
+    for (int i = 1; i < st.attempts && backoff < SENSOR_INIT_MAX_RETRY_MS; i++) backoff *= 2;
+    if (backoff > SENSOR_INIT_MAX_RETRY_MS) backoff = SENSOR_INIT_MAX_RETRY_MS;
+
+    st.state = SLOT_FAILED;
+    st.retryAt = millis() + backoff;
+    LOGW(LOG_MOD_SENSOR, "Slot %d (%s) init %s, attempt %u, retry in %lu s", slot, config.sensors[slot].type,
+         reason, st.attempts, (unsigned long)(backoff / 1000));
+}
+
+void Sensor::stepSlot(int slot) {
+    SlotInit& st = _init[slot];
+    uint32_t now = millis();
+
+    if (st.state == SLOT_FAILED || st.state == SLOT_QUARANTINED) {
+        if ((int32_t)(now - st.retryAt) < 0) return;
+        // Fresh driver so no half-initialized library state carries over
+        delete sensors[slot];
+        sensors[slot] = createDriver(config.sensors[slot]);
+        st.state = SLOT_INITIALIZING;
+        st.startedAt = now;
+    }
+
+    const SensorConfig& cfg = config.sensors[slot];
+    if (cfg.i2cMultiplexerChannel >= 0 && isI2CType(cfg.type)) {
+        selectI2CChannel(cfg.i2cMultiplexerChannel);
+    }
+
+    SensorInitStatus status = sensors[slot]->begin();
+    if (status == SENSOR_INIT_READY) {
+        st.state = SLOT_READY;
+        LOGI(LOG_MOD_SENSOR, "Slot %d (%s) ready after %lu ms", slot, cfg.type, (unsigned long)(millis() - st.startedAt));
+    } else if (status == SENSOR_INIT_FAILED) {
+        failSlot(slot, "failed");
+    } else if (now - st.startedAt > SENSOR_INIT_TIMEOUT_MS) {
+        failSlot(slot, "timed out");
+    }
+}
+
+void Sensor::loop() {
+    for (uint8_t slot : activeSlots) {
+        if (_init[slot].state != SLOT_READY) stepSlot(slot);
+    }
+}
+
+bool Sensor::initializing() const {
+    for (uint8_t slot : activeSlots) {
+        if (_init[slot].state == SLOT_INITIALIZING) return true;
+    }
+    return false;
+}
+
+void Sensor::recordRead(int slot, bool ok) {
+    SlotHealth& h = _health[slot];
+    uint32_t now = millis();
 
-        SensorInterface* impl = nullptr;
-        
-        // Temperature & Humidity
-        if (type == "dht11") impl = new DHTSensor(pin, 11);
-        else if (type == "dht22") impl = new DHTSensor(pin, 22);
-        else if (type == "ds18b20") impl = new DS18B20Sensor(pin);
-        else if (type == "bme280") impl = new BME280Sensor(pin, addr);
-        else if (type == "bmp280") impl = new BMP280Sensor(pin, addr);
-        else if (type == "sht31") impl = new SHT31Sensor(pin, addr);
-        
-        // Analog
-        else if (type == "lm35") impl = new AnalogSensor(pin, type, "Temperature", "C");
-        else if (type == "tmp36") impl = new AnalogSensor(pin, type, "Temperature", "C");
-        else if (type == "mq2") impl = new AnalogSensor(pin, type, "Smoke", "raw");
-        else if (type == "mq135") impl = new AnalogSensor(pin, type, "Air Quality", "raw");
-        else if (type == "ldr") impl = new AnalogSensor(pin, type, "Light", "raw");
-        else if (type == "soil_moisture") impl = new AnalogSensor(pin, type, "Moisture", "%");
-        else if (type == "water_level") impl = new AnalogSensor(pin, type, "Level", "raw");
-        else if (type == "ph_sensor") impl = new AnalogSensor(pin, type, "pH", "raw");
-        else if (type == "tds_meter") impl = new AnalogSensor(pin, type, "TDS", "ppm");
-        
-        // I2C Special
-        else if (type == "ccs811" || type == "scd40") impl = new AirQualityI2C(pin, type, addr);
-        else if (type == "bh1750" || type == "tsl2561" || type == "vl53l0x") impl = new LightProximityI2C(pin, type, addr);
-        
-        // Digital
-        else if (type == "pir" || type == "relay") impl = new DigitalSensor(pin, type);
-
-        if (impl) {
-            impl->begin();
-            sensors.push_back(impl);
-            allSensorData[activeSensorCount].pin = pin;
-            allSensorData[activeSensorCount].valid = false;
-            activeSensorCount++;
+    if (ok) {
+        if (h.failing) {
+            h.failingMs += now - h.failingSince;
+            LOGI(LOG_MOD_SENSOR, "Slot %d (%s) recovered after %u failed reads", slot, config.sensors[slot].type, h.consecutiveFailures);
         }
+        h.failing = false;
+        h.consecutiveFailures = 0;
+        h.skipReads = 0;
+        return;
+    }
+
+    metrics.sensorReadErrors++;
+    h.errors++;
+    if (h.consecutiveFailures < 0xFFFF) h.consecutiveFailures++;
+    if (!h.failing) {
+        h.failing = true;
+        h.failingSince = now;
     }
+
+    if (h.consecutiveFailures >= SENSOR_QUARANTINE_FAILURES) {
+        SlotInit& st = _init[slot];
+        st.state = SLOT_QUARANTINED;
+        st.retryAt = now + SENSOR_QUARANTINE_PROBE_MS;
+        LOGW(LOG_MOD_SENSOR, "Slot %d (%s) quarantined after %u failed reads", slot, config.sensors[slot].type, h.consecutiveFailures);
+        return;
+    }
+    uint32_t skip = (1UL << (h.consecutiveFailures - 1)) - 1;
+    h.skipReads = skip > SENSOR_BACKOFF_MAX_SKIP ? SENSOR_BACKOFF_MAX_SKIP : skip;
 }
 
-void Sensor::update() {
-    int activeIdx = 0;
-    for (int i = 0; i < MAX_SENSORS; i++) {
-        String type = String(config.sensors[i].type);
-        if (type == "none" || type == "") continue;
-        
-        bool isI2C = (type == "bme280" || type == "bmp280" || type == "sht31" || 
-                      type == "ccs811" || type == "scd40" || type == "bh1750" || 
-                      type == "tsl2561" || type == "vl53l0x");
+int Sensor::update() {
+    TRACE_SCOPE("sensor.update", "sensor");
+    int i2cReads = 0;
+    int i2cFailures = 0;
+    int due = 0;
+    uint32_t now = millis();
+    bool adaptive = config.adaptiveSampling;
+
+    for (size_t n = 0; n < activeSlots.size(); n++) {
+        int slot = activeSlots[n];
+        SensorReadings& out = allSensorData[n];
+        SlotInitState state = _init[slot].state;
+        SlotRate& rate = _rate[slot];
+        out.fresh = false;
 
-        if (isI2C && config.sensors[i].i2cMultiplexerChannel >= 0) {
-            selectI2CChannel(config.sensors[i].i2cMultiplexerChannel);
+        if (adaptive) {
+            if ((int32_t)(now - rate.nextAt) < 0) continue;
+            rate.nextAt += rate.intervalMs;
+            if ((int32_t)(now - rate.nextAt) >= 0) rate.nextAt = now + rate.intervalMs;
         }
-        
-        if (activeIdx < (int)sensors.size()) {
-            allSensorData[activeIdx] = sensors[activeIdx]->read();
-            
-            // Apply Offsets
-            for (auto& r : allSensorData[activeIdx].readings) {
-                if (r.type == "Temperature") r.value += config.sensors[i].tempOffset;
-                if (r.type == "Humidity") r.value += config.sensors[i].humOffset;
+        due++;
+
+        if (state == SLOT_READY) {
+            // While backing off, the last failed result (and its error) stays in place
+            if (_health[slot].skipReads > 0) {
+                _health[slot].skipReads--;
+                continue;
+            }
+            {
+                TRACE_SCOPE_ARG(traceName(config.sensors[slot].type), "sensor", slot);
+                readSlot(slot, out);
             }
-            
-            activeIdx++;
+            out.fresh = true;
+            recordRead(slot, out.valid);
+            if (adaptive && out.valid) adaptRate(slot, out);
+            out.intervalMs = adaptive ? rate.intervalMs : SAMPLE_INTERVAL_MS;
+            if (isI2CType(config.sensors[slot].type)) {
+                i2cReads++;
+                if (!out.valid) i2cFailures++;
+            }
+            continue;
+        }
+        out.valid = false;
+        out.readings.clear();
+        out.error = state == SLOT_INITIALIZING ? "initializing" : state == SLOT_QUARANTINED ? "quarantined" : "failed";
+    }
+
+    // A held SDA line or every I2C device failing at once points at the bus, not the devices
+    _i2cFailedPasses = (i2cReads > 0 && i2cFailures == i2cReads) ? _i2cFailedPasses + 1 : 0;
+    if (i2cFailures > 0 && (digitalRead(SDA) == LOW || _i2cFailedPasses >= SENSOR_I2C_RECOVER_PASSES)) {
+        recoverI2CBus();
+        _i2cFailedPasses = 0;
+    }
+    if (due > 0) publishSnapshot();
+    return due;
+}
+
+struct RateBounds {
+    const char* type;
+    uint32_t minMs;
+    uint32_t maxMs;
+};
+
+// Fastest rate each part can actually deliver a fresh value at
+static const RateBounds rateBounds[] = {
+    { "dht11", 2000, SENSOR_RATE_MAX_MS },
+    { "dht22", 2000, SENSOR_RATE_MAX_MS },
+    { "scd40", 5000, SENSOR_RATE_MAX_MS },  // Periodic measurement mode
+    { "ccs811", 1000, SENSOR_RATE_MAX_MS },
+    { "ds18b20", 2000, SENSOR_RATE_MAX_MS }, // 750 ms conversion at 12 bits, started after each read
+    { "pir", SAMPLE_INTERVAL_MS, SAMPLE_INTERVAL_MS },
+    { "relay", SAMPLE_INTERVAL_MS, SAMPLE_INTERVAL_MS },
+};
+
+// Change per minute (and noise) worth sampling faster for
+struct ChannelStep {
+    const char* type;
+    float step;
+};
+
+static const ChannelStep channelSteps[] = {
+    { "Temperature", 0.5f },
+    { "Humidity", 2.0f },
+    { "Pressure", 0.5f },
+    { "CO2", 50.0f },
+    { "TVOC", 25.0f },
+    { "Distance", 20.0f },
+    { "Moisture", 2.0f },
+};
+
+static void boundsFor(const char* type, uint32_t& minMs, uint32_t& maxMs) {
+    minMs = SENSOR_RATE_MIN_MS;
+    maxMs = SENSOR_RATE_MAX_MS;
+    for (const RateBounds& b : rateBounds) {
+        if (strcmp(type, b.type) == 0) {
+            minMs = b.minMs;
+            maxMs = b.maxMs;
+            return;
+        }
+    }
+}
+
+static float stepFor(const String& type, float value) {
+    for (const ChannelStep& c : channelSteps) {
+        if (type == c.type) return c.step;
+    }
+    // Raw or unitless channels: 5% of the current level
+    float step = fabsf(value) * 0.05f;
+    return step < 1.0f ? 1.0f : step;
+}
+
+void Sensor::resetRate(int slot) {
+    uint32_t minMs, maxMs;
+    boundsFor(config.sensors[slot].type, minMs, maxMs);
+    _rate[slot] = SlotRate();
+    _rate[slot].intervalMs = constrain((uint32_t)SAMPLE_INTERVAL_MS, minMs, maxMs);
+    _rate[slot].nextAt = millis();
+}
+
+void Sensor::adaptRate(int slot, const SensorReadings& out) {
+    SlotRate& r = _rate[slot];
+    uint32_t now = millis();
+    bool windowDone = r.primed && now - r.anchorAt >= SENSOR_RATE_WINDOW_MS;
+    float minutes = (now - r.anchorAt) / 60000.0f;
+    bool fast = false;
+    bool calm = windowDone; // Slowing down waits for a full window
+
+    size_t channels = out.readings.size() < SENSOR_RATE_CHANNELS ? out.readings.size() : SENSOR_RATE_CHANNELS;
+    for (size_t i = 0; i < channels; i++) {
+        float v = out.readings[i].value;
+        if (isnan(v)) continue;
+        if (!(r.primed & (1 << i))) {
+            if (!r.primed) r.anchorAt = now;
+            r.primed |= 1 << i;
+            r.anchor[i] = r.mean[i] = v;
+            r.var[i] = 0;
+            calm = false;
+            continue;
+        }
+
+        float step = stepFor(out.readings[i].type, v);
+        // Exponentially weighted mean and variance
+        float diff = v - r.mean[i];
+        float incr = SENSOR_RATE_ALPHA * diff;
+        r.mean[i] += incr;
+        r.var[i] = (1 - SENSOR_RATE_ALPHA) * (r.var[i] + diff * incr);
+
+        if (r.var[i] > step * step) fast = true;
+        if (r.var[i] > step * step / 16) calm = false;
+        if (windowDone) {
+            float perMinute = fabsf(r.mean[i] - r.anchor[i]) / minutes;
+            r.anchor[i] = r.mean[i];
+            if (perMinute > step) fast = true;
+            if (perMinute > step / 4) calm = false;
+        }
+    }
+    if (windowDone) r.anchorAt = now;
+
+    uint32_t minMs, maxMs;
+    boundsFor(config.sensors[slot].type, minMs, maxMs);
+    uint32_t interval = r.intervalMs;
+    if (fast) interval = max(minMs, interval / SENSOR_RATE_SPEEDUP);
+    else if (calm) interval = min(maxMs, interval * 2);
+    if (interval == r.intervalMs) return;
+
+    LOGD(LOG_MOD_SENSOR, "Slot %d (%s) sampling every %lu ms (was %lu)", slot, config.sensors[slot].type,
+         (unsigned long)interval, (unsigned long)r.intervalMs);
+    r.intervalMs = interval;
+    r.nextAt = now + interval;
+}
+
+#ifdef CALID_BENCHMARK
+// Stand-in driver with the same allocation pattern as a two-value I2C sensor
+class SimulatedSensor : public SensorInterface {
+public:
+    explicit SimulatedSensor(int pin) : _pin(pin) {}
+    SensorInitStatus begin() override { return SENSOR_INIT_READY; }
+    SensorReadings read() override {
+        SensorReadings data;
+        data.pin = _pin;
+        data.sensorType = "SIM";
+        data.valid = true;
+        data.readings.push_back({"Temperature", 20.0f + (random(-20, 20) / 10.0f), "C"});
+        data.readings.push_back({"Humidity", 50.0f + (random(-50, 50) / 10.0f), "%"});
+        return data;
+    }
+private:
+    int _pin;
+};
+
+String Sensor::benchmark(const int* counts, int n) {
+    const int cycles = 10;
+    String out = "[";
+
+    // update() runs on the live tables and config slots, so they are swapped out
+    // for the run. The caller holds the sensor lock; config must not be saved meanwhile.
+    std::vector<SensorInterface*> liveSensors;
+    std::vector<SlotInit> liveInit;
+    std::vector<SlotHealth> liveHealth;
+    std::vector<SlotRate> liveRate;
+    std::vector<SensorReadings> liveData;
+    liveSensors.swap(sensors);
+    liveInit.swap(_init);
+    liveHealth.swap(_health);
+    liveRate.swap(_rate);
+    liveData.swap(allSensorData);
+    std::vector<SensorConfig> liveConfig(config.sensors, config.sensors + MAX_SENSORS);
+    bool liveAdaptive = config.adaptiveSampling;
+    config.adaptiveSampling = false; // Every slot is due on every pass
+
+    for (int c = 0; c < n; c++) {
+        int count = counts[c] > MAX_SENSORS ? MAX_SENSORS : counts[c];
+        uint32_t heapBefore = ESP.getFreeHeap();
+
+        for (int i = 0; i < count; i++) {
+            SensorConfig& cfg = config.sensors[i];
+            strlcpy(cfg.type, "sht31", sizeof(cfg.type));
+            cfg.pin = i;
+            // Beyond one bus' worth every slot sits behind a mux channel, as it would for real
+            cfg.i2cMultiplexerChannel = count > 8 ? i : -1;
+            cfg.tempOffset = 0;
+            cfg.humOffset = 0;
         }
+        sensors.assign(count, nullptr);
+        for (int i = 0; i < count; i++) sensors[i] = new SimulatedSensor(i);
+        _init.assign(count, SlotInit());
+        for (SlotInit& st : _init) st.state = SLOT_READY;
+        _health.assign(count, SlotHealth());
+        _rate.assign(count, SlotRate());
+        primeSensorData();
+
+        uint32_t heapAfterInit = ESP.getFreeHeap();
+        uint32_t start = micros();
+        for (int k = 0; k < cycles; k++) update();
+        uint32_t cycleUs = (micros() - start) / cycles;
+        uint32_t heapSteady = ESP.getFreeHeap();
+
+        for (auto d : sensors) delete d;
+        sensors.clear();
+        allSensorData.clear();
+
+        if (c > 0) out += ",";
+        out += "{\"sensors\":" + String(count) +
+               ",\"cycleUs\":" + String(cycleUs) +
+               ",\"heapInit\":" + String(heapBefore - heapAfterInit) +
+               ",\"heapSteady\":" + String(heapBefore - heapSteady) + "}";
     }
-}
\ No newline at end of file
+
+    memcpy(config.sensors, liveConfig.data(), sizeof(config.sensors));
+    config.adaptiveSampling = liveAdaptive;
+    sensors.swap(liveSensors);
+    _init.swap(liveInit);
+    _health.swap(liveHealth);
+    _rate.swap(liveRate);
+    primeSensorData();
+    // Last real readings back in place of the "initializing" placeholders
+    allSensorData.swap(liveData);
+    publishSnapshot();
+    return out + "]";
+}
+#endif
@@ -4,22 +4,151 @@
 #include "../include/SensorInterface.h"
 #include "config.h"
 #include <vector>
+#include <memory>
 
-// Global storage for multiple sensors
-extern SensorReadings allSensorData[MAX_SENSORS];
+// Drivers are only created while this much heap would remain afterwards
+#if defined(ESP8266)
+#define SENSOR_MIN_FREE_HEAP 16384
+#else
+#define SENSOR_MIN_FREE_HEAP 40960
+#endif
+
+// Driver start-up runs as a per-slot state machine from loop(). A driver may stay
+// pending this long before the attempt counts as failed; failed slots are retried
+// with a doubling delay.
+#define SENSOR_INIT_TIMEOUT_MS 15000
+#define SENSOR_INIT_RETRY_MS 5000
+#define SENSOR_INIT_MAX_RETRY_MS 300000
+
+// Read failures back off per slot: after the n-th consecutive failure the next
+// 2^(n-1) - 1 update passes skip the slot (capped). At SENSOR_QUARANTINE_FAILURES the
+// driver is parked and re-created once per SENSOR_QUARANTINE_PROBE_MS.
+#define SENSOR_BACKOFF_MAX_SKIP 31
+#define SENSOR_QUARANTINE_FAILURES 8
+#define SENSOR_QUARANTINE_PROBE_MS 3600000
+// Update passes in a row where every I2C read failed before the bus is reset
+#define SENSOR_I2C_RECOVER_PASSES 2
+
+// Adaptive sampling (config.adaptiveSampling): each slot runs at its own interval.
+// A channel changing faster than its step per minute, or noisier than one step,
+// divides the interval by SENSOR_RATE_SPEEDUP; while every channel stays under a
+// quarter of that the interval doubles. The rate of change is taken from the
+// smoothed level across a window, so quantization flicker between back-to-back
+// reads does not count. Bounds come from the sensor type.
+#define SENSOR_TICK_MS 1000          // How often callers offer update() a pass
+#define SENSOR_RATE_MIN_MS 1000
+#define SENSOR_RATE_MAX_MS 600000
+#define SENSOR_RATE_SPEEDUP 4
+#define SENSOR_RATE_ALPHA 0.2f       // Smoothing for the level and variance estimates
+#define SENSOR_RATE_CHANNELS 4       // Readings per slot that are tracked
+#define SENSOR_RATE_WINDOW_MS 60000  // Shortest span the rate of change is measured over
+
+enum SlotInitState : uint8_t {
+    SLOT_INITIALIZING = 0,
+    SLOT_READY,
+    SLOT_FAILED,
+    SLOT_QUARANTINED // Too many failed reads; probed again at retryAt
+};
+
+struct SlotInit {
+    SlotInitState state = SLOT_INITIALIZING;
+    uint8_t attempts = 0;   // Failed attempts since the slot was (re)configured
+    uint32_t startedAt = 0; // millis() the current attempt began
+    uint32_t retryAt = 0;   // millis() of the next attempt while failed
+};
+
+struct SlotHealth {
+    uint32_t errors = 0;              // Failed reads since the slot was configured
+    uint16_t consecutiveFailures = 0;
+    uint8_t skipReads = 0;            // Update passes left to skip
+    bool failing = false;
+    uint32_t failingSince = 0;        // millis() the current failure streak began
+    uint32_t failingMs = 0;           // Completed streaks
+
+    uint32_t totalFailingMs(uint32_t now) const { return failingMs + (failing ? now - failingSince : 0); }
+};
+
+struct SlotRate {
+    uint32_t intervalMs = 0;
+    uint32_t nextAt = 0;    // millis() the slot is next due
+    uint32_t anchorAt = 0;  // millis() the current window started
+    uint8_t primed = 0;     // Bit per channel with a baseline
+    float anchor[SENSOR_RATE_CHANNELS]; // Smoothed level at the window start
+    float mean[SENSOR_RATE_CHANNELS];
+    float var[SENSOR_RATE_CHANNELS];
+};
+
+// Global storage for multiple sensors, one entry per active driver. Only the
+// sampling side touches these; other tasks read sensorSnapshot() instead.
+extern std::vector<SensorReadings> allSensorData;
 extern int activeSensorCount;
 
+// Immutable copy of the table, published after every update. Readers keep the
+// reference for as long as they need it (e.g. across a chunked response) and never
+// observe a table that is being written; the writer never waits for them.
+struct SensorSnapshot {
+    uint32_t generation = 0;
+    uint32_t takenAtMs = 0;
+    std::vector<SensorReadings> data;
+    std::vector<SlotInit> init;     // Parallel to data, empty in testing mode
+    std::vector<SlotHealth> health;
+};
+typedef std::shared_ptr<const SensorSnapshot> SensorSnapshotRef;
+
+SensorSnapshotRef sensorSnapshot();
+
 class Sensor {
 public:
     Sensor();
+    // Creates drivers without touching hardware; loop() brings them up
     void begin();
+
+    // Re-creates the driver for a single config slot, leaving the others running
+    void beginSlot(int slot);
+
+    // Advances every pending driver by one init step; call every loop pass
+    void loop();
     
-    // Updates readings from all hardware sensors
-    void update(); 
+    // True while any driver is still coming up
+    bool initializing() const;
+
+    // Reads ready drivers that are due; the rest report "initializing" or "failed".
+    // Returns the number of slots that came due (all of them unless sampling is adaptive).
+    int update();
+
+    // Applies the I2C transaction timeout from config
+    void configureBus();
+
+    // Publishes allSensorData (plus per-slot state) as the current snapshot
+    void publishSnapshot();
+
+    #ifdef CALID_BENCHMARK
+    // Times update() over N simulated drivers and measures heap; returns a JSON summary
+    String benchmark(const int* counts, int n);
+    #endif
 
 private:
-    std::vector<SensorInterface*> sensors;
+    std::vector<SensorInterface*> sensors; // Indexed by config slot
+    std::vector<uint8_t> activeSlots;      // Slots that have a driver, in order
+    std::vector<SlotInit> _init;           // Indexed by config slot
+    std::vector<SlotHealth> _health;       // Indexed by config slot
+    std::vector<SlotRate> _rate;           // Indexed by config slot
+    uint8_t _i2cFailedPasses;
+    int8_t _selectedMux;
+
+    SensorInterface* createDriver(const SensorConfig& cfg);
+    bool isI2CType(const char* type);
     void selectI2CChannel(int channel);
+    void primeSensorData();
+    void readSlot(int slot, SensorReadings& out);
+    void stepSlot(int slot);
+    void failSlot(int slot, const char* reason);
+    void recordRead(int slot, bool ok);
+    void resetRate(int slot);
+    void adaptRate(int slot, const SensorReadings& out);
+    void recoverI2CBus();
 };
 
+extern Sensor sensor;
+
 #endif // SENSOR_H
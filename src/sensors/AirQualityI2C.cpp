@@ -1,17 +1,35 @@
 #include "AirQualityI2C.h"
+#include "../logging.h"
 
 AirQualityI2C::AirQualityI2C(int pin, String type, int i2cAddress) 
-    : _pin(pin), _type(type), _i2cAddress(i2cAddress) {}
+    : _pin(pin), _type(type), _i2cAddress(i2cAddress), _started(false), _startedAt(0) {}
 
-void AirQualityI2C::begin() {
-    if (_type == "ccs811") {
-        if (!ccs.begin(_i2cAddress)) {
-            Serial.println("CCS811 not found");
+// Both parts need a few seconds before the first sample, so begin() starts
+// them and then reports pending until data is available.
+SensorInitStatus AirQualityI2C::begin() {
+    if (!_started) {
+        if (_type == "ccs811") {
+            if (!ccs.begin(_i2cAddress)) {
+                LOGW(LOG_MOD_SENSOR, "CCS811 not found at 0x%02X", _i2cAddress);
+                return SENSOR_INIT_FAILED;
+            }
+        } else if (_type == "scd40") {
+            scd.begin(Wire);
+            if (scd.startPeriodicMeasurement() != 0) {
+                LOGW(LOG_MOD_SENSOR, "SCD40 did not start periodic measurement");
+                return SENSOR_INIT_FAILED;
+            }
         }
-    } else if (_type == "scd40") {
-        scd.begin(Wire);
-        scd.startPeriodicMeasurement();
+        _started = true;
+        _startedAt = millis();
+        return SENSOR_INIT_PENDING;
+    }
+
+    if (_type == "ccs811") {
+        return ccs.available() ? SENSOR_INIT_READY : SENSOR_INIT_PENDING;
     }
+    // SCD40 delivers its first measurement 5 s after the start command
+    return millis() - _startedAt >= 5000 ? SENSOR_INIT_READY : SENSOR_INIT_PENDING;
 }
 
 SensorReadings AirQualityI2C::read() {
@@ -8,12 +8,14 @@
 class AirQualityI2C : public SensorInterface {
 public:
     AirQualityI2C(int pin, String type, int i2cAddress);
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     int _pin;
     String _type;
     int _i2cAddress;
+    bool _started;
+    uint32_t _startedAt;
     Adafruit_CCS811 ccs;
     SensirionI2CScd4x scd;
 };
@@ -3,8 +3,9 @@
 AnalogSensor::AnalogSensor(int pin, String type, String dataType, String unit) 
     : _pin(pin), _type(type), _dataType(dataType), _unit(unit) {}
 
-void AnalogSensor::begin() {
+SensorInitStatus AnalogSensor::begin() {
     pinMode(_pin, INPUT);
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings AnalogSensor::read() {
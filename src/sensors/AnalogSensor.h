@@ -6,7 +6,7 @@
 class AnalogSensor : public SensorInterface {
 public:
     AnalogSensor(int pin, String type, String dataType, String unit);
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     int _pin;
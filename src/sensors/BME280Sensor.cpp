@@ -1,11 +1,14 @@
 #include "BME280Sensor.h"
+#include "../logging.h"
 
 BME280Sensor::BME280Sensor(int pin, int i2cAddress) : _pin(pin), _i2cAddress(i2cAddress) {}
 
-void BME280Sensor::begin() {
-    if (!bme.begin(_i2cAddress)) { 
-        Serial.printf("Could not find a valid BME280 sensor at 0x%02X!\n", _i2cAddress);
+SensorInitStatus BME280Sensor::begin() {
+    if (!bme.begin(_i2cAddress)) {
+        LOGW(LOG_MOD_SENSOR, "Could not find a valid BME280 sensor at 0x%02X", _i2cAddress);
+        return SENSOR_INIT_FAILED;
     }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings BME280Sensor::read() {
@@ -7,7 +7,7 @@
 class BME280Sensor : public SensorInterface {
 public:
     BME280Sensor(int pin, int i2cAddress = 0x76); 
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     Adafruit_BME280 bme;
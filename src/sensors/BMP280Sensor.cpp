@@ -1,12 +1,14 @@
 #include "BMP280Sensor.h"
+#include "../logging.h"
 
 BMP280Sensor::BMP280Sensor(int pin, int i2cAddress) : _pin(pin), _i2cAddress(i2cAddress) {}
 
-void BMP280Sensor::begin() {
-    if (!bmp.begin(_i2cAddress)) { 
-        Serial.printf("Could not find a valid BMP280 sensor at 0x%02X!
-", _i2cAddress);
+SensorInitStatus BMP280Sensor::begin() {
+    if (!bmp.begin(_i2cAddress)) {
+        LOGW(LOG_MOD_SENSOR, "Could not find a valid BMP280 sensor at 0x%02X", _i2cAddress);
+        return SENSOR_INIT_FAILED;
     }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings BMP280Sensor::read() {
@@ -7,7 +7,7 @@
 class BMP280Sensor : public SensorInterface {
 public:
     BMP280Sensor(int pin, int i2cAddress = 0x77); 
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     Adafruit_BMP280 bmp;
@@ -2,8 +2,9 @@
 
 DHTSensor::DHTSensor(int pin, int type) : dht(pin, type), _pin(pin), _type(type) {}
 
-void DHTSensor::begin() {
+SensorInitStatus DHTSensor::begin() {
     dht.begin();
+    return SENSOR_INIT_READY; // No presence check; failures surface on read
 }
 
 SensorReadings DHTSensor::read() {
@@ -7,7 +7,7 @@
 class DHTSensor : public SensorInterface {
 public:
     DHTSensor(int pin, int type);
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     DHT dht;
@@ -1,25 +1,134 @@
 #include "DS18B20Sensor.h"
+#include "../logging.h"
 
-DS18B20Sensor::DS18B20Sensor(int pin) : oneWire(pin), sensors(&oneWire), _pin(pin) {}
+std::vector<DS18B20Bus*> DS18B20Sensor::_buses;
 
-void DS18B20Sensor::begin() {
-    sensors.begin();
+DS18B20Bus::DS18B20Bus(int pin, uint8_t resolution)
+    : pin(pin), refs(0), owner(nullptr), resolution(resolution), wire(pin), dallas(&wire), requestedAt(0), pending(false) {}
+
+void DS18B20Bus::enumerate() {
+    dallas.begin();
+    addresses.clear();
+
+    int count = dallas.getDeviceCount();
+    for (int i = 0; i < count; i++) {
+        DeviceAddress addr;
+        if (dallas.getAddress(addr, i)) {
+            addresses.push_back(std::vector<uint8_t>(addr, addr + 8));
+            dallas.setResolution(addr, resolution);
+        }
+    }
+    // Conversion is started here and collected on the next read
+    dallas.setWaitForConversion(false);
+    LOGI(LOG_MOD_SENSOR, "DS18B20 bus on pin %d: %u device(s), %u-bit", pin, (unsigned)addresses.size(), resolution);
+}
+
+void DS18B20Bus::requestConversion() {
+    dallas.requestTemperatures();
+    requestedAt = millis();
+    pending = true;
+}
+
+uint16_t DS18B20Bus::conversionMs() const {
+    // 93.75 ms at 9 bits, doubling per extra bit
+    return 750 >> (12 - constrain(resolution, 9, 12));
+}
+
+DS18B20Bus* DS18B20Sensor::acquire(int pin, uint8_t resolution) {
+    for (auto bus : _buses) {
+        if (bus->pin == pin) {
+            bus->refs++;
+            return bus;
+        }
+    }
+    DS18B20Bus* bus = new DS18B20Bus(pin, resolution);
+    bus->refs = 1;
+    _buses.push_back(bus);
+    return bus;
+}
+
+void DS18B20Sensor::release(DS18B20Bus* bus, DS18B20Sensor* sensor) {
+    if (!bus) return;
+    // A refused slot on the same pin takes over on its next begin()
+    if (bus->owner == sensor) bus->owner = nullptr;
+    if (--bus->refs > 0) return;
+    for (size_t i = 0; i < _buses.size(); i++) {
+        if (_buses[i] == bus) {
+            _buses.erase(_buses.begin() + i);
+            break;
+        }
+    }
+    delete bus;
+}
+
+DS18B20Sensor::DS18B20Sensor(int pin, uint8_t resolution)
+    : _pin(pin), _resolution(constrain(resolution, 9, 12)), _bus(nullptr) {}
+
+DS18B20Sensor::~DS18B20Sensor() {
+    release(_bus, this);
+}
+
+SensorInitStatus DS18B20Sensor::begin() {
+    if (!_bus) _bus = acquire(_pin, _resolution);
+    if (_bus->owner && _bus->owner != this) {
+        if (_bus->resolution != _resolution) {
+            LOGW(LOG_MOD_SENSOR, "DS18B20 on pin %d: %u-bit conflicts with the %u-bit slot already on the bus", _pin, _resolution, _bus->resolution);
+        } else {
+            LOGW(LOG_MOD_SENSOR, "DS18B20 on pin %d is already read by another slot, which reports every probe", _pin);
+        }
+        return SENSOR_INIT_FAILED;
+    }
+    if (!_bus->owner) {
+        _bus->owner = this;
+        _bus->resolution = _resolution;
+        _bus->enumerate();
+        if (!_bus->addresses.empty()) _bus->requestConversion();
+    }
+    if (_bus->addresses.empty()) {
+        LOGW(LOG_MOD_SENSOR, "No DS18B20 found on pin %d", _pin);
+        return SENSOR_INIT_FAILED;
+    }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings DS18B20Sensor::read() {
     SensorReadings data;
     data.pin = _pin;
     data.sensorType = "DS18B20";
-    
-    sensors.requestTemperatures();
-    float t = sensors.getTempCByIndex(0);
-    
-    data.valid = (t != DEVICE_DISCONNECTED_C);
-    
-    if (data.valid) {
-        data.readings.push_back({"Temperature", t, "C"});
-    } else {
+    data.valid = false;
+
+    if (_bus->addresses.empty()) {
+        // Nothing found at boot; probes may have been plugged in since
+        _bus->enumerate();
+        _bus->pending = false;
+    }
+    if (!_bus->pending) _bus->requestConversion();
+
+    // Normally long finished, as the conversion was started a full cycle ago
+    while (!_bus->dallas.isConversionComplete() && millis() - _bus->requestedAt < _bus->conversionMs() + 50) {
+        delay(5);
+    }
+
+    for (const auto& addr : _bus->addresses) {
+        float t = _bus->dallas.getTempC(addr.data());
+        if (t == DEVICE_DISCONNECTED_C) continue;
+
+        // Labelled even when alone, so a probe keeps its channel as others are added
+        Reading r = {"Temperature", t, "C"};
+        char rom[17];
+        for (int b = 0; b < 8; b++) snprintf(rom + b * 2, 3, "%02X", addr[b]);
+        r.device = rom;
+        data.readings.push_back(r);
+    }
+
+    // Start the next conversion now so it completes while the rest of the cycle runs
+    _bus->requestConversion();
+
+    data.valid = !data.readings.empty();
+    if (!data.valid) {
         data.error = "Failed to read from DS18B20 sensor";
+    } else if (data.readings.size() < _bus->addresses.size()) {
+        data.error = String(_bus->addresses.size() - data.readings.size()) + " probe(s) not responding";
     }
     return data;
 }
@@ -4,16 +4,44 @@
 #include "../../include/SensorInterface.h"
 #include <OneWire.h>
 #include <DallasTemperature.h>
+#include <vector>
+
+class DS18B20Sensor;
+
+// One per OneWire pin. Devices are enumerated once and read by cached ROM address
+// after a single broadcast conversion. One slot owns the bus and reports every
+// probe on it; further slots on the same pin are refused rather than duplicating it.
+struct DS18B20Bus {
+    int pin;
+    int refs;
+    DS18B20Sensor* owner;
+    uint8_t resolution;
+    OneWire wire;
+    DallasTemperature dallas;
+    std::vector<std::vector<uint8_t>> addresses;
+    unsigned long requestedAt;
+    bool pending;
+
+    DS18B20Bus(int pin, uint8_t resolution);
+    void enumerate();
+    void requestConversion();
+    uint16_t conversionMs() const;
+};
 
 class DS18B20Sensor : public SensorInterface {
 public:
-    DS18B20Sensor(int pin);
-    void begin() override;
+    DS18B20Sensor(int pin, uint8_t resolution = 12);
+    ~DS18B20Sensor();
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
-    OneWire oneWire;
-    DallasTemperature sensors;
     int _pin;
+    uint8_t _resolution;
+    DS18B20Bus* _bus;
+
+    static std::vector<DS18B20Bus*> _buses;
+    static DS18B20Bus* acquire(int pin, uint8_t resolution);
+    static void release(DS18B20Bus* bus, DS18B20Sensor* sensor);
 };
 
 #endif
@@ -1,13 +1,20 @@
 #include "DigitalSensor.h"
+#include "../edge_capture.h"
 
-DigitalSensor::DigitalSensor(int pin, String type) : _pin(pin), _type(type) {}
+DigitalSensor::DigitalSensor(int pin, String type) : _pin(pin), _type(type), _edge(-1) {}
 
-void DigitalSensor::begin() {
+DigitalSensor::~DigitalSensor() {
+    EdgeCapture::detach(_edge);
+}
+
+SensorInitStatus DigitalSensor::begin() {
     if (_type == "relay") {
         pinMode(_pin, OUTPUT);
     } else {
         pinMode(_pin, INPUT);
+        if (_edge < 0) _edge = EdgeCapture::attach(_pin, _type.c_str());
     }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings DigitalSensor::read() {
@@ -16,10 +23,20 @@ SensorReadings DigitalSensor::read() {
     data.sensorType = _type;
     data.valid = true;
 
-    float val = (float)digitalRead(_pin);
     String dataType = (_type == "pir") ? "Motion" : "State";
     String unit = "bool";
 
-    data.readings.push_back({dataType, val, unit});
+    if (_edge < 0) {
+        data.readings.push_back({dataType, (float)digitalRead(_pin), unit});
+        return data;
+    }
+
+    uint32_t rises;
+    float activePct;
+    uint8_t level;
+    EdgeCapture::takeWindow(_edge, rises, activePct, level);
+    data.readings.push_back({dataType, (float)level, unit});
+    data.readings.push_back({"Events", (float)rises, "count"});
+    data.readings.push_back({"Active", activePct, "%"});
     return data;
 }
@@ -3,14 +3,18 @@
 
 #include "../../include/SensorInterface.h"
 
+// PIR inputs are captured edge by edge (see EdgeCapture); read() then reports
+// the current level plus motion events and time active since the last read.
 class DigitalSensor : public SensorInterface {
 public:
     DigitalSensor(int pin, String type);
-    void begin() override;
+    ~DigitalSensor() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     int _pin;
     String _type;
+    int _edge; // EdgeCapture input, -1 when polled
 };
 
 #endif
@@ -1,17 +1,24 @@
 #include "LightProximityI2C.h"
+#include "../logging.h"
 
 LightProximityI2C::LightProximityI2C(int pin, String type, int i2cAddress) 
     : _pin(pin), _type(type), _i2cAddress(i2cAddress), tsl(i2cAddress, 12345) {}
 
-void LightProximityI2C::begin() {
+SensorInitStatus LightProximityI2C::begin() {
+    bool found = true;
     if (_type == "bh1750") {
-        bh1750.begin(BH1750::CONTINUOUS_HIGH_RES_MODE, _i2cAddress);
+        found = bh1750.begin(BH1750::CONTINUOUS_HIGH_RES_MODE, _i2cAddress);
     } else if (_type == "tsl2561") {
-        tsl.begin();
-        tsl.enableAutoRange(true);
+        found = tsl.begin();
+        if (found) tsl.enableAutoRange(true);
     } else if (_type == "vl53l0x") {
-        vl.begin(_i2cAddress);
+        found = vl.begin(_i2cAddress);
     }
+    if (!found) {
+        LOGW(LOG_MOD_SENSOR, "%s not found at 0x%02X", _type.c_str(), _i2cAddress);
+        return SENSOR_INIT_FAILED;
+    }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings LightProximityI2C::read() {
@@ -9,7 +9,7 @@
 class LightProximityI2C : public SensorInterface {
 public:
     LightProximityI2C(int pin, String type, int i2cAddress);
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     int _pin;
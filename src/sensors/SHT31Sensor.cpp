@@ -1,12 +1,14 @@
 #include "SHT31Sensor.h"
+#include "../logging.h"
 
 SHT31Sensor::SHT31Sensor(int pin, int i2cAddress) : _pin(pin), _i2cAddress(i2cAddress) {}
 
-void SHT31Sensor::begin() {
+SensorInitStatus SHT31Sensor::begin() {
     if (!sht.begin(_i2cAddress)) {
-        Serial.printf("Could not find a valid SHT31 sensor at 0x%02X!
-", _i2cAddress);
+        LOGW(LOG_MOD_SENSOR, "Could not find a valid SHT31 sensor at 0x%02X", _i2cAddress);
+        return SENSOR_INIT_FAILED;
     }
+    return SENSOR_INIT_READY;
 }
 
 SensorReadings SHT31Sensor::read() {
@@ -7,7 +7,7 @@
 class SHT31Sensor : public SensorInterface {
 public:
     SHT31Sensor(int pin, int i2cAddress = 0x44);
-    void begin() override;
+    SensorInitStatus begin() override;
     SensorReadings read() override;
 private:
     Adafruit_SHT31 sht;
@@ -0,0 +1,41 @@
+#ifndef CALID_SPSC_RING_H
+#define CALID_SPSC_RING_H
+
+#include <atomic>
+#include <stddef.h>
+
+// Bounded single-producer/single-consumer ring. push() and pop() never block or
+// take a lock: the head is only written by the producer and the tail only by the
+// consumer. N must be a power of two. push() is forced inline so an IRAM interrupt
+// handler can produce into a ring without calling into flash.
+template <typename T, size_t N>
+class SpscRing {
+    static_assert((N & (N - 1)) == 0, "SpscRing size must be a power of two");
+public:
+    inline __attribute__((always_inline)) bool push(const T& item) {
+        size_t head = _head.load(std::memory_order_relaxed);
+        if (head - _tail.load(std::memory_order_acquire) == N) return false;
+        _items[head & (N - 1)] = item;
+        _head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& item) {
+        size_t tail = _tail.load(std::memory_order_relaxed);
+        if (_head.load(std::memory_order_acquire) == tail) return false;
+        item = _items[tail & (N - 1)];
+        _tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t size() const {
+        return _head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire);
+    }
+
+private:
+    T _items[N];
+    std::atomic<size_t> _head{0};
+    std::atomic<size_t> _tail{0};
+};
+
+#endif
@@ -0,0 +1,195 @@
+#include "telemetry.h"
+#include "config.h"
+#include "sensor.h"
+#include "metrics.h"
+#include "logging.h"
+#include "time_sync.h"
+#include "trace.h"
+#include <ArduinoJson.h>
+
+#if defined(ESP8266)
+#include <ESP8266WiFi.h>
+#include <ESP8266HTTPClient.h>
+#else
+#include <WiFi.h>
+#include <HTTPClient.h>
+#endif
+#include <WiFiClientSecure.h>
+
+static bool fixedStarted = false;
+static uint32_t fixedNextAt = 0;
+
+bool acquireSample() {
+    if (!config.adaptiveSampling || config.testingMode) {
+        uint32_t now = millis();
+        if (fixedStarted && (int32_t)(now - fixedNextAt) < 0) return false;
+        fixedNextAt = (fixedStarted && now - fixedNextAt < SAMPLE_INTERVAL_MS) ? fixedNextAt + SAMPLE_INTERVAL_MS : now + SAMPLE_INTERVAL_MS;
+        fixedStarted = true;
+    }
+
+    if (!config.testingMode) {
+        return sensor.update() > 0;
+    }
+
+    activeSensorCount = 2;
+    allSensorData.resize(2);
+    allSensorData[0].pin = 4;
+    allSensorData[0].sensorType = "DHT22";
+    allSensorData[0].valid = true;
+    allSensorData[0].readings.clear();
+    allSensorData[0].readings.push_back({"Temperature", 22.5f + (random(-20, 20) / 10.0f), "C"});
+    allSensorData[0].readings.push_back({"Humidity", 45.0f + (random(-50, 50) / 10.0f), "%"});
+
+    allSensorData[1].pin = 5;
+    allSensorData[1].sensorType = "BME280";
+    allSensorData[1].valid = true;
+    allSensorData[1].readings.clear();
+    allSensorData[1].readings.push_back({"Temperature", 24.1f + (random(-20, 20) / 10.0f), "C"});
+    allSensorData[1].readings.push_back({"Humidity", 40.0f + (random(-50, 50) / 10.0f), "%"});
+    allSensorData[1].readings.push_back({"Pressure", 1012.5f + (random(-100, 100) / 10.0f), "hPa"});
+    allSensorData[0].timestampMs = allSensorData[1].timestampMs = TimeSync::nowMs();
+    allSensorData[0].intervalMs = allSensorData[1].intervalMs = SAMPLE_INTERVAL_MS;
+    allSensorData[0].fresh = allSensorData[1].fresh = true;
+    sensor.publishSnapshot();
+    return true;
+}
+
+String encodeMqttTelemetry(const SensorReadings* data, int count) {
+    int fresh = 0;
+    for (int i = 0; i < count; i++) {
+        if (data[i].fresh) fresh++;
+    }
+    if (fresh == 0) return String();
+
+    TRACE_SCOPE("encode.mqtt", "json");
+    uint32_t encodeStart = micros();
+    JsonDocument mqttDoc;
+    mqttDoc["sensorId"] = config.sensorId;
+    mqttDoc["adoptionCode"] = config.getAdoptionCode();
+    
+    SystemHealth health = config.getSystemHealth();
+    JsonObject sys = mqttDoc["system"].to<JsonObject>();
+    sys["rssi"] = health.rssi;
+    sys["uptime"] = health.uptime;
+    sys["freeHeap"] = health.freeHeap;
+    sys["largestFreeBlock"] = health.largestFreeBlock;
+    sys["heapFragmentation"] = health.heapFragmentation;
+    sys["minFreeHeap"] = health.minFreeHeap;
+    sys["minStackFree"] = health.minStackFree;
+    sys["minStackTask"] = health.minStackTask;
+    sys["allocFailures"] = health.allocFailures;
+    sys["tlsAtRisk"] = health.tlsAtRisk;
+    sys["resetReason"] = health.resetReason;
+    sys["configWrites"] = health.configWrites;
+
+    JsonArray sensorsArr = mqttDoc["sensors"].to<JsonArray>();
+
+    for (int i = 0; i < count; i++) {
+        if (data[i].valid && data[i].fresh) {
+            JsonObject s = sensorsArr.add<JsonObject>();
+            s["pin"] = data[i].pin;
+            s["type"] = data[i].sensorType;
+            if (data[i].timestampMs) s["ts"] = data[i].timestampMs;
+            if (data[i].intervalMs) s["intervalMs"] = data[i].intervalMs;
+            JsonArray rd = s["readings"].to<JsonArray>();
+            for (const auto& r : data[i].readings) {
+                JsonObject ro = rd.add<JsonObject>();
+                ro["type"] = r.type;
+                ro["value"] = r.value;
+                ro["unit"] = r.unit;
+                if (r.device.length()) ro["device"] = r.device;
+            }
+        }
+    }
+    String mqttPayload;
+    serializeJson(mqttDoc, mqttPayload);
+    metrics.jsonEncode.observe(micros() - encodeStart);
+    return mqttPayload;
+}
+
+String encodeHttpUpload(const SensorReadings* data, int count) {
+    TRACE_SCOPE("encode.http", "json");
+    uint32_t encodeStart = micros();
+    String payload = "[";
+    for (int i = 0; i < count; i++) {
+        if (!data[i].valid || !data[i].fresh) continue;
+        for (const auto& r : data[i].readings) appendHttpRow(payload, data[i], r);
+    }
+    metrics.jsonEncode.observe(micros() - encodeStart);
+    if (payload.length() == 1) return String();
+    payload += "]";
+    return payload;
+}
+
+// "time" stays a local-time string for existing consumers; "timestamp" is the exact read time
+void appendHttpRow(String& payload, const SensorReadings& sensor, const Reading& r) {
+    if (payload.length() > 1) payload += ",";
+    payload += "{\"time\":\"" + formatTime(sensor.timestampMs) + 
+               "\",\"timestamp\":" + (sensor.timestampMs ? formatEpochMs(sensor.timestampMs) : String("null")) +
+               ",\"sensor_id\":\"" + String(config.sensorId) + 
+               "\",\"pin\":" + String(sensor.pin) + 
+               (sensor.intervalMs ? ",\"interval_ms\":" + String(sensor.intervalMs) : String()) + 
+               ",\"sensor_type\":\"" + sensor.sensorType +
+               "\",\"data_type\":\"" + r.type + 
+               (r.device.length() ? "\",\"device\":\"" + r.device : String()) + 
+               "\",\"value\":" + (isnan(r.value) ? String("null") : String(r.value, 3)) + 
+               ",\"unit\":\"" + r.unit + "\"}";
+}
+
+int postHttpUpload(const String& payload) {
+    String apiEndpoint = String(config.apiEndpoint);
+    if (apiEndpoint.length() == 0 || payload.length() == 0) return 0;
+
+    bool isHttps = apiEndpoint.startsWith("https://");
+    HTTPClient http;
+    WiFiClient client;
+    WiFiClientSecure secureClient;
+
+    if (isHttps) {
+        secureClient.setInsecure();
+        http.begin(secureClient, apiEndpoint + "/sensor/data/write");
+    } else {
+        http.begin(client, apiEndpoint + "/sensor/data/write");
+    }
+
+    http.addHeader("Content-Type", "application/json");
+    http.addHeader("X-Sensor-Id", config.sensorId);
+    http.addHeader("X-Sensor-Api-Key", config.apiKey);
+
+    uint32_t postStart = micros();
+    int httpResponseCode;
+    {
+        TRACE_SCOPE("http.post", "net");
+        httpResponseCode = http.POST(payload);
+    }
+    metrics.httpPost.observe(micros() - postStart);
+    metrics.recordUploadStatus(httpResponseCode);
+    if (httpResponseCode > 0) {
+        LOGD(LOG_MOD_SYSTEM, "HTTP upload status %d", httpResponseCode);
+    } else {
+        LOGW(LOG_MOD_SYSTEM, "HTTP upload error: %s", http.errorToString(httpResponseCode).c_str());
+    }
+    http.end();
+    return httpResponseCode;
+}
+
+String formatTime(uint64_t utcMs) {
+    time_t local = (time_t)(utcMs / 1000) + config.utcOffset;
+    struct tm timeinfo;
+    gmtime_r(&local, &timeinfo);
+    char buffer[20];
+    strftime(buffer, sizeof(buffer), "%Y-%m-%d %H:%M:%S", &timeinfo);
+    return String(buffer);
+}
+
+// Not every core's String/printf handles 64-bit integers
+String formatEpochMs(uint64_t ms) {
+    char buffer[21];
+    char* p = buffer + sizeof(buffer) - 1;
+    *p = '\0';
+    do {
+        *--p = '0' + ms % 10;
+        ms /= 10;
+    } while (ms);
+    return String(p);
+}
@@ -0,0 +1,30 @@
+#ifndef CALID_TELEMETRY_H
+#define CALID_TELEMETRY_H
+
+#include <Arduino.h>
+#include "../include/SensorInterface.h"
+
+#define SAMPLE_INTERVAL_MS 60000
+#define HEARTBEAT_INTERVAL_MS 300000
+
+// Refreshes allSensorData: simulated values in testing mode, the drivers otherwise.
+// Call every SENSOR_TICK_MS; returns false when nothing was due, which without
+// adaptive sampling is every call but one per SAMPLE_INTERVAL_MS.
+bool acquireSample();
+
+// Payload builders. They only read the snapshot passed in, so they can run away
+// from the sampling path. Entries that were not read this pass (not fresh) are
+// left out; both return an empty string when nothing is left to send.
+String encodeMqttTelemetry(const SensorReadings* data, int count);
+String encodeHttpUpload(const SensorReadings* data, int count);
+// Adds one row, stamped with sensor.timestampMs, to an upload array opened with "["
+void appendHttpRow(String& payload, const SensorReadings& sensor, const Reading& r);
+
+// POSTs an encoded batch to config.apiEndpoint and records the outcome; returns the HTTP code
+int postHttpUpload(const String& payload);
+
+// "YYYY-MM-DD HH:MM:SS" in config.utcOffset local time
+String formatTime(uint64_t utcMs);
+String formatEpochMs(uint64_t ms);
+
+#endif
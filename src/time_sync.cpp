@@ -0,0 +1,134 @@
+#include "time_sync.h"
+#include "config.h"
+#include "boot_profile.h"
+#include "logging.h"
+#include <sys/time.h>
+
+#ifdef ESP32
+#include <esp_sntp.h>
+#include <esp_timer.h>
+static portMUX_TYPE timeMux = portMUX_INITIALIZER_UNLOCKED;
+#define TIME_LOCK() portENTER_CRITICAL(&timeMux)
+#define TIME_UNLOCK() portEXIT_CRITICAL(&timeMux)
+#else
+#include <coredecls.h>
+#define TIME_LOCK()
+#define TIME_UNLOCK()
+
+// Overrides the core's weak default (1 hour) so both platforms poll alike
+uint32_t sntp_update_delay_MS_rfc_not_less_than_15000() {
+    return TIME_SYNC_INTERVAL_MS;
+}
+#endif
+
+volatile bool TimeSync::_valid = false;
+bool TimeSync::_fromSntp = false;
+int64_t TimeSync::_offsetUs = 0;
+int64_t TimeSync::_anchorUs = 0;
+float TimeSync::_driftPpm = 0;
+int32_t TimeSync::_lastErrorMs = 0;
+volatile uint32_t TimeSync::_syncs = 0;
+uint32_t TimeSync::_lastSyncMs = 0;
+
+static int64_t monotonicUs() {
+    #ifdef ESP32
+    return esp_timer_get_time();
+    #else
+    return (int64_t)micros64();
+    #endif
+}
+
+void TimeSync::begin() {
+    // lwIP keeps the pointer, and config.ntpServer lives for the whole run
+    configTime(0, 0, config.ntpServer);
+    #ifdef ESP32
+    sntp_set_sync_interval(TIME_SYNC_INTERVAL_MS);
+    sntp_set_time_sync_notification_cb([](struct timeval*) { onSync(); });
+    #else
+    settimeofday_cb([](bool fromSntp) { if (fromSntp) onSync(); });
+    #endif
+    LOGI(LOG_MOD_SYSTEM, "SNTP started against %s", config.ntpServer);
+}
+
+uint64_t TimeSync::nowMs() {
+    TIME_LOCK();
+    bool valid = _valid;
+    int64_t offsetUs = _offsetUs;
+    int64_t anchorUs = _anchorUs;
+    float driftPpm = _driftPpm;
+    TIME_UNLOCK();
+    if (!valid) return 0;
+
+    int64_t mono = monotonicUs();
+    int64_t utcUs = mono + offsetUs + (int64_t)((mono - anchorUs) * (double)driftPpm / 1e6);
+    return utcUs / 1000;
+}
+
+void TimeSync::restore(uint64_t utcMs) {
+    int64_t mono = monotonicUs();
+    TIME_LOCK();
+    _offsetUs = (int64_t)utcMs * 1000 - mono;
+    _anchorUs = mono;
+    _fromSntp = false;
+    _valid = true;
+    TIME_UNLOCK();
+}
+
+bool TimeSync::waitForSync(uint32_t timeoutMs) {
+    uint32_t before = _syncs;
+    unsigned long start = millis();
+    while (_syncs == before) {
+        if (millis() - start >= timeoutMs) return false;
+        delay(10);
+    }
+    return true;
+}
+
+// Runs in the SNTP context after the system clock has been set
+void TimeSync::onSync() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    int64_t utcUs = (int64_t)tv.tv_sec * 1000000 + tv.tv_usec;
+    int64_t mono = monotonicUs();
+
+    TIME_LOCK();
+    bool hadAnchor = _valid, fromSntp = _fromSntp;
+    int64_t offsetUs = _offsetUs, anchorUs = _anchorUs;
+    float driftPpm = _driftPpm;
+    TIME_UNLOCK();
+
+    int32_t errorMs = 0;
+    if (hadAnchor) {
+        int64_t elapsed = mono - anchorUs;
+        int64_t predicted = mono + offsetUs + (int64_t)(elapsed * (double)driftPpm / 1e6);
+        errorMs = (utcUs - predicted) / 1000;
+        // What is left after the current correction nudges the estimate (half gain, so one bad reply can't swing it)
+        if (fromSntp && elapsed >= (int64_t)TIME_DRIFT_MIN_INTERVAL_MS * 1000) {
+            driftPpm += 0.5f * (float)((double)(utcUs - predicted) * 1e6 / elapsed);
+            driftPpm = constrain(driftPpm, -TIME_DRIFT_MAX_PPM, TIME_DRIFT_MAX_PPM);
+        }
+    }
+
+    TIME_LOCK();
+    _offsetUs = utcUs - mono;
+    _anchorUs = mono;
+    _driftPpm = driftPpm;
+    _lastErrorMs = errorMs;
+    _fromSntp = true;
+    _valid = true;
+    _lastSyncMs = millis();
+    _syncs++;
+    TIME_UNLOCK();
+
+    BootProfile::mark("ntp_synced");
+}
+
+void TimeSync::toJson(JsonObject obj) {
+    obj["synced"] = (bool)_valid;
+    obj["nowMs"] = nowMs();
+    obj["server"] = config.ntpServer;
+    obj["syncs"] = (uint32_t)_syncs;
+    if (_syncs) obj["lastSyncAgeMs"] = millis() - _lastSyncMs;
+    obj["driftPpm"] = _driftPpm;
+    obj["lastErrorMs"] = _lastErrorMs;
+}
@@ -0,0 +1,42 @@
+#ifndef CALID_TIME_SYNC_H
+#define CALID_TIME_SYNC_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define TIME_SYNC_INTERVAL_MS 3600000      // SNTP poll interval once synced
+#define TIME_DRIFT_MIN_INTERVAL_MS 600000  // Shortest sync gap used for a drift estimate
+#define TIME_DRIFT_MAX_PPM 500.0f
+
+// Wall clock for sample stamps. SNTP runs in the background (lwIP); each sync
+// re-anchors a monotonic microsecond clock, and the error seen at the next sync
+// feeds a drift estimate that corrects the clock between syncs. Times are UTC;
+// config.utcOffset only applies when formatting.
+class TimeSync {
+public:
+    static void begin(); // (Re)starts SNTP against config.ntpServer; does not block
+    static bool synced() { return _valid; }
+    static uint64_t nowMs(); // UTC epoch ms, 0 until the clock is set
+    static uint32_t now() { return nowMs() / 1000; }
+
+    // Seeds the clock from an estimate (e.g. across deep sleep); the next SNTP sync corrects it
+    static void restore(uint64_t utcMs);
+    // Waits for an SNTP sync newer than the call
+    static bool waitForSync(uint32_t timeoutMs);
+
+    static void toJson(JsonObject obj);
+
+private:
+    static volatile bool _valid;
+    static bool _fromSntp;        // Anchor came from SNTP, not restore()
+    static int64_t _offsetUs;     // UTC minus monotonic at the anchor
+    static int64_t _anchorUs;     // Monotonic time of the anchor
+    static float _driftPpm;
+    static int32_t _lastErrorMs;  // Clock error corrected by the last sync
+    static volatile uint32_t _syncs;
+    static uint32_t _lastSyncMs;
+
+    static void onSync();
+};
+
+#endif
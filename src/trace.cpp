@@ -0,0 +1,126 @@
+#include "trace.h"
+
+#ifdef ESP32
+static portMUX_TYPE traceMux = portMUX_INITIALIZER_UNLOCKED;
+#define TRACE_LOCK() portENTER_CRITICAL(&traceMux)
+#define TRACE_UNLOCK() portEXIT_CRITICAL(&traceMux)
+#else
+#define TRACE_LOCK() noInterrupts()
+#define TRACE_UNLOCK() interrupts()
+#endif
+
+TraceEvent Trace::_ring[TRACE_RING_SIZE];
+volatile uint32_t Trace::_seq = 0;
+#ifdef ESP32
+void* Trace::_threads[TRACE_MAX_THREADS];
+uint8_t Trace::_threadCount = 0;
+#else
+uint8_t Trace::_threadCount = 1;
+#endif
+
+void Trace::record(const char* name, const char* cat, uint32_t startUs, uint32_t us, uint32_t cycles, int16_t arg) {
+    // The cycle counter stops in light sleep, follows DFS and wraps after ~18 s at
+    // 240 MHz; when it disagrees with micros() the span falls back to micros()
+    uint64_t ns = (uint64_t)cycles * 1000 / cyclesPerUs();
+    uint64_t usNs = (uint64_t)us * 1000;
+    uint64_t slack = 2000 + usNs / 8;
+    bool coarse = ns + slack < usNs || ns > usNs + slack;
+
+    uint8_t tid = 0;
+    TRACE_LOCK();
+    #ifdef ESP32
+    // One Perfetto track per FreeRTOS task; tasks beyond the table share the last one
+    void* task = xTaskGetCurrentTaskHandle();
+    while (tid < _threadCount && _threads[tid] != task) tid++;
+    if (tid == _threadCount) {
+        if (_threadCount < TRACE_MAX_THREADS) _threads[_threadCount++] = task;
+        else tid = TRACE_MAX_THREADS - 1;
+    }
+    #endif
+    TraceEvent& e = _ring[_seq % TRACE_RING_SIZE];
+    e.name = name;
+    e.cat = cat;
+    e.startUs = startUs;
+    e.dur = coarse ? us : (uint32_t)ns;
+    e.arg = arg;
+    e.tid = tid;
+    e.coarse = coarse;
+    _seq = _seq + 1;
+    TRACE_UNLOCK();
+}
+
+bool Trace::read(uint32_t seq, TraceEvent& out) {
+    TRACE_LOCK();
+    bool live = seq < _seq && _seq - seq <= TRACE_RING_SIZE;
+    if (live) out = _ring[seq % TRACE_RING_SIZE];
+    TRACE_UNLOCK();
+    return live;
+}
+
+const char* Trace::threadName(uint8_t tid) {
+    #ifdef ESP32
+    if (tid < _threadCount) return pcTaskGetName((TaskHandle_t)_threads[tid]);
+    return "?";
+    #else
+    return "loop";
+    #endif
+}
+
+uint32_t Trace::cyclesPerUs() {
+    #if defined(ESP32)
+    return getCpuFrequencyMhz();
+    #elif defined(ESP8266)
+    return ESP.getCpuFreqMHz();
+    #else
+    return 1000; // Host builds count nanoseconds
+    #endif
+}
+
+// Sections: header, thread names, events (oldest first), footer
+bool traceNextChunk(TraceCursor& cur, char* out, size_t len) {
+    for (;;) {
+        switch (cur.section) {
+        case 0:
+            cur.end = Trace::sequence();
+            cur.next = cur.end > TRACE_RING_SIZE ? cur.end - TRACE_RING_SIZE : 0;
+            snprintf(out, len, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[");
+            cur.section = 1;
+            return true;
+
+        case 1:
+            if (cur.item < Trace::threadCount()) {
+                snprintf(out, len, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                         cur.item ? "," : "", cur.item, Trace::threadName(cur.item));
+                cur.item++;
+                return true;
+            }
+            cur.section = 2;
+            break;
+
+        case 2:
+            while (cur.next < cur.end) {
+                TraceEvent e;
+                // Overwritten since the export started: skip
+                if (!Trace::read(cur.next++, e)) continue;
+                char args[24] = "";
+                if (e.arg >= 0) snprintf(args, sizeof(args), ",\"args\":{\"arg\":%d}", e.arg);
+                char dur[16];
+                if (e.coarse) snprintf(dur, sizeof(dur), "%lu", (unsigned long)e.dur);
+                else snprintf(dur, sizeof(dur), "%lu.%03u", (unsigned long)(e.dur / 1000), (unsigned)(e.dur % 1000));
+                snprintf(out, len, ",{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%lu,\"dur\":%s,\"pid\":1,\"tid\":%u%s}",
+                         e.name, e.cat, (unsigned long)e.startUs, dur, e.tid, args);
+                return true;
+            }
+            cur.section = 3;
+            break;
+
+        case 3:
+            snprintf(out, len, "]}");
+            cur.section = 4;
+            return true;
+
+        default:
+            return false;
+        }
+    }
+}
@@ -0,0 +1,95 @@
+#ifndef CALID_TRACE_H
+#define CALID_TRACE_H
+
+#include <Arduino.h>
+#if !defined(ESP32) && !defined(ESP8266)
+#include <chrono>
+#endif
+
+#if defined(ESP8266)
+#define TRACE_RING_SIZE 64
+#else
+#define TRACE_RING_SIZE 512
+#endif
+#define TRACE_MAX_THREADS 8
+
+// One complete ("X") event. Names and categories are static strings.
+struct TraceEvent {
+    const char* name;
+    const char* cat;
+    uint32_t startUs;   // micros() at entry
+    uint32_t dur;       // ns from the cycle counter, or us when `coarse`
+    int16_t arg;        // Event-specific, e.g. the sensor slot; -1 if unused
+    uint8_t tid;
+    bool coarse;        // Cycle count unusable (light sleep, DFS, wrap), timed with micros()
+};
+
+// Fixed RAM ring of timed spans around the hot paths (sensor reads, encoding,
+// publish, HTTP, flash writes), exported as Chrome trace-event JSON for Perfetto.
+class Trace {
+public:
+    static inline uint32_t cycles() {
+        #if defined(ESP32) || defined(ESP8266)
+        return ESP.getCycleCount();
+        #else
+        return (uint32_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+        #endif
+    }
+
+    static void record(const char* name, const char* cat, uint32_t startUs, uint32_t us, uint32_t cycles, int16_t arg);
+
+    // Events are read back by sequence number; one that has been overwritten is skipped
+    static uint32_t sequence() { return _seq; }
+    static bool read(uint32_t seq, TraceEvent& out);
+    static uint8_t threadCount() { return _threadCount; }
+    static const char* threadName(uint8_t tid);
+    static uint32_t cyclesPerUs();
+
+private:
+    static TraceEvent _ring[TRACE_RING_SIZE];
+    static volatile uint32_t _seq;
+    #ifdef ESP32
+    static void* _threads[TRACE_MAX_THREADS];
+    #endif
+    static uint8_t _threadCount;
+};
+
+// Times the enclosing scope
+class TraceScope {
+public:
+    TraceScope(const char* name, const char* cat, int16_t arg = -1)
+        : _name(name), _cat(cat), _arg(arg), _startUs(micros()), _start(Trace::cycles()) {}
+    ~TraceScope() {
+        uint32_t cycles = Trace::cycles() - _start;
+        Trace::record(_name, _cat, _startUs, micros() - _startUs, cycles, _arg);
+    }
+private:
+    const char* _name;
+    const char* _cat;
+    int16_t _arg;
+    uint32_t _startUs;
+    uint32_t _start;
+};
+
+#ifndef CALID_NO_TRACE
+#define TRACE_CONCAT_(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_(a, b)
+#define TRACE_SCOPE(name, cat) TraceScope TRACE_CONCAT(_trace, __LINE__)(name, cat)
+#define TRACE_SCOPE_ARG(name, cat, arg) TraceScope TRACE_CONCAT(_trace, __LINE__)(name, cat, arg)
+#else
+#define TRACE_SCOPE(name, cat)
+#define TRACE_SCOPE_ARG(name, cat, arg)
+#endif
+
+// Incremental Chrome trace JSON, one event per call, like MetricsCursor
+struct TraceCursor {
+    int section = 0;
+    int item = 0;
+    uint32_t next = 0; // Event sequence numbers still to send, fixed when the export starts
+    uint32_t end = 0;
+};
+
+bool traceNextChunk(TraceCursor& cur, char* out, size_t len);
+
+#endif
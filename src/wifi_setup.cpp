@@ -1,38 +1,263 @@
 #include "wifi_setup.h"
 #include "config.h"
+#include "logging.h"
+#include "metrics.h"
+#include "time_sync.h"
+#include "power_manager.h"
 #include <WiFiManager.h>
+#include <lwip/netif.h>
+#include <lwip/dhcp.h>
+#include <lwip/etharp.h>
 
 #ifdef ESP32
 #include <WebServer.h>
+#include <lwip/tcpip.h>
+#include <esp_wifi.h>
 #else
 #include <ESP8266WebServer.h>
 #endif
 
-void runWifiSetup() {
-    WiFiManager wm;
-    
-    // Set custom hostname
+#define WIFI_CACHE_MAGIC 0x5732 // "W2"
+
+// lwIP runs in its own task on ESP32
+#ifdef ESP32
+#define WIFI_LWIP_LOCK() LOCK_TCPIP_CORE()
+#define WIFI_LWIP_UNLOCK() UNLOCK_TCPIP_CORE()
+#else
+#define WIFI_LWIP_LOCK()
+#define WIFI_LWIP_UNLOCK()
+#endif
+
+// Last good association, kept in RTC memory so it survives resets and deep
+// sleep but not a power cycle. A stale entry only costs one failed fast attempt.
+struct WifiCache {
+    uint16_t magic;
+    uint16_t crc;      // Low half of the CRC32 over everything after it
+    uint8_t bssid[6];
+    uint8_t channel;
+    uint8_t reserved;
+    uint32_t ip;
+    uint32_t gateway;
+    uint32_t subnet;
+    uint32_t dns;
+    uint32_t renewAt;  // UTC seconds at the lease's T1, 0 when unknown; reused only before it
+};
+static_assert(sizeof(WifiCache) <= WIFI_RTC_BLOCKS * 4, "WifiCache overflows its RTC blocks");
+
+#ifdef ESP32
+RTC_NOINIT_ATTR static WifiCache rtcWifiCache;
+#endif
+
+WifiConnectStats wifiConnectStats;
+
+static WifiCache cache;
+static bool cacheValid = false;
+static unsigned long connectStart = 0;
+
+static uint16_t cacheCrc(const WifiCache& c) {
+    size_t start = offsetof(WifiCache, bssid);
+    return (uint16_t)configCrc32((const uint8_t*)&c + start, sizeof(c) - start);
+}
+
+// When the DHCP server wants this lease renewed. Needs the clock, which on a
+// plain reset is not set yet, so only duty-cycle wakes (clock carried in RTC) reuse leases.
+static uint32_t leaseRenewAt() {
+    uint64_t nowMs = TimeSync::nowMs();
+    if (!nowMs) return 0;
+    WIFI_LWIP_LOCK();
+    struct netif* nif = netif_default;
+    struct dhcp* dhcp = nif ? netif_dhcp_data(nif) : nullptr;
+    uint32_t t1 = dhcp ? dhcp->offered_t1_renew : 0;
+    WIFI_LWIP_UNLOCK();
+    return t1 ? (uint32_t)(nowMs / 1000) + t1 : 0;
+}
+
+static bool leaseFresh() {
+    uint64_t nowMs = TimeSync::nowMs();
+    return cache.renewAt && nowMs && nowMs / 1000 < cache.renewAt;
+}
+
+// A reused lease is only trusted once the gateway answers ARP on it
+static bool gatewayReachable(unsigned long timeoutMs) {
+    ip4_addr_t gw;
+    ip4_addr_set_u32(&gw, cache.gateway);
+    unsigned long start = millis();
+    bool requested = false;
+    while (millis() - start < timeoutMs) {
+        struct eth_addr* mac;
+        const ip4_addr_t* ip;
+        WIFI_LWIP_LOCK();
+        struct netif* nif = netif_default;
+        bool found = nif && etharp_find_addr(nif, &gw, &mac, &ip) >= 0;
+        if (nif && !found && !requested) requested = etharp_request(nif, &gw) == ERR_OK;
+        WIFI_LWIP_UNLOCK();
+        if (found) return true;
+        delay(10);
+    }
+    return false;
+}
+
+static void loadCache() {
+    #ifdef ESP32
+    cache = rtcWifiCache;
+    #else
+    ESP.rtcUserMemoryRead(WIFI_RTC_OFFSET, (uint32_t*)&cache, sizeof(cache));
+    #endif
+    cacheValid = cache.magic == WIFI_CACHE_MAGIC && cache.crc == cacheCrc(cache) && cache.channel > 0;
+}
+
+static void storeCache(const WifiCache& c) {
+    #ifdef ESP32
+    rtcWifiCache = c;
+    #else
+    ESP.rtcUserMemoryWrite(WIFI_RTC_OFFSET, (uint32_t*)&c, sizeof(c));
+    #endif
+}
+
+static void saveCache() {
+    WifiCache c = {};
+    c.magic = WIFI_CACHE_MAGIC;
+    memcpy(c.bssid, WiFi.BSSID(), sizeof(c.bssid));
+    c.channel = WiFi.channel();
+    c.ip = (uint32_t)WiFi.localIP();
+    c.gateway = (uint32_t)WiFi.gatewayIP();
+    c.subnet = (uint32_t)WiFi.subnetMask();
+    c.dns = (uint32_t)WiFi.dnsIP();
+    // A reused lease keeps the deadline DHCP gave it
+    c.renewAt = wifiConnectStats.leaseReused ? cache.renewAt : leaseRenewAt();
+    c.crc = cacheCrc(c);
+    if (cacheValid && memcmp(&c, &cache, sizeof(c)) == 0) return;
+    cache = c;
+    cacheValid = true;
+    storeCache(c);
+}
+
+static void clearCache() {
+    cache.magic = 0;
+    cacheValid = false;
+    storeCache(cache);
+}
+
+static void applyAddressing(bool reuseLease) {
+    if (config.staticIp) {
+        IPAddress ip, gateway, subnet, dns;
+        if (ip.fromString(config.staticAddress) && gateway.fromString(config.staticGateway) &&
+            subnet.fromString(config.staticSubnet)) {
+            if (!dns.fromString(config.staticDns)) dns = gateway;
+            WiFi.config(ip, gateway, subnet, dns);
+            return;
+        }
+        LOGW(LOG_MOD_WIFI, "Static IP settings are invalid, using DHCP");
+    } else if (reuseLease) {
+        WiFi.config(IPAddress(cache.ip), IPAddress(cache.gateway), IPAddress(cache.subnet), IPAddress(cache.dns));
+        return;
+    }
+    IPAddress none(0, 0, 0, 0);
+    WiFi.config(none, none, none);
+}
+
+static bool waitForConnection(unsigned long timeoutMs) {
+    unsigned long start = millis();
+    while (WiFi.status() != WL_CONNECTED && millis() - start < timeoutMs) {
+        delay(10);
+    }
+    return WiFi.status() == WL_CONNECTED;
+}
+
+void beginWifiConnect() {
+    connectStart = millis();
+
+    // Hostname must be set before the interface comes up
     String hostname = "calid-" + config.getAdoptionCode();
     #ifdef ESP32
     WiFi.setHostname(hostname.c_str());
     #else
     WiFi.hostname(hostname);
     #endif
+    WiFi.mode(WIFI_STA);
+
+    loadCache();
+    if (strlen(config.ssid) == 0) {
+        PowerManager::configureAssociation();
+        WiFi.begin(); // Credentials persisted by the SDK, if any
+        return;
+    }
+
+    wifiConnectStats.fastPath = cacheValid;
+    wifiConnectStats.leaseReused = cacheValid && !config.staticIp && leaseFresh();
+    applyAddressing(wifiConnectStats.leaseReused);
+    // Skips the scan when cached: straight to the last AP on its channel
+    int32_t channel = cacheValid ? cache.channel : 0;
+    const uint8_t* bssid = cacheValid ? cache.bssid : nullptr;
+    #ifdef ESP32
+    // begin() rewrites the station config with the SDK's default listen interval,
+    // so it only stores it here and the interval is patched in before connecting
+    WiFi.begin(config.ssid, config.password, channel, bssid, false);
+    PowerManager::configureAssociation();
+    esp_wifi_connect();
+    #else
+    PowerManager::configureAssociation();
+    WiFi.begin(config.ssid, config.password, channel, bssid);
+    #endif
+}
+
+bool runWifiSetup(bool allowPortal) {
+    bool connected = waitForConnection(wifiConnectStats.fastPath ? WIFI_FAST_CONNECT_TIMEOUT_MS : WIFI_CONNECT_TIMEOUT_MS);
+
+    if (connected && wifiConnectStats.leaseReused && !gatewayReachable(WIFI_GATEWAY_CHECK_MS)) {
+        LOGW(LOG_MOD_WIFI, "Gateway silent on the cached lease, rerunning DHCP");
+        wifiConnectStats.leaseReused = false;
+        WiFi.disconnect();
+        applyAddressing(false);
+        WiFi.begin(config.ssid, config.password, cache.channel, cache.bssid);
+        connected = waitForConnection(WIFI_CONNECT_TIMEOUT_MS);
+    }
+
+    if (!connected && wifiConnectStats.fastPath) {
+        LOGW(LOG_MOD_WIFI, "Fast connect to cached AP failed, scanning");
+        metrics.wifiFastConnectFailures++;
+        clearCache();
+        wifiConnectStats.fastPath = false;
+        wifiConnectStats.leaseReused = false;
+        WiFi.disconnect();
+        applyAddressing(false);
+        WiFi.begin(config.ssid, config.password);
+        connected = waitForConnection(WIFI_CONNECT_TIMEOUT_MS);
+    }
 
-    // Professional looking setup page
-    wm.setParamsPage(true);
-    std::vector<const char *> menu = {"wifi","info","param","sep","restart"};
-    wm.setMenu(menu);
-    wm.setTitle("Calid Sensor Hub Setup");
-    
-    // Non-blocking wait for connection
-    if (!wm.autoConnect("Calid_Setup")) {
-        Serial.println("Failed to connect or hit timeout");
-        ESP.restart();
+    if (!connected && !allowPortal) {
+        LOGW(LOG_MOD_WIFI, "Saved network not reachable");
+        return false;
     }
 
-    // Capture the newly configured credentials
+    if (!connected) {
+        LOGW(LOG_MOD_WIFI, "Saved network not reachable, starting setup portal");
+        WiFiManager wm;
+
+        // Professional looking setup page
+        wm.setParamsPage(true);
+        std::vector<const char *> menu = {"wifi","info","param","sep","restart"};
+        wm.setMenu(menu);
+        wm.setTitle("Calid Sensor Hub Setup");
+        
+        // Non-blocking wait for connection
+        if (!wm.autoConnect("Calid_Setup")) {
+            LOGE(LOG_MOD_WIFI, "Failed to connect or hit timeout");
+            logger.flush();
+            ESP.restart();
+        }
+    }
+
+    wifiConnectStats.associationMs = millis() - connectStart;
+    metrics.wifiConnect.observe(wifiConnectStats.associationMs * 1000);
+    if (wifiConnectStats.fastPath) metrics.wifiFastConnects++;
+    LOGI(LOG_MOD_WIFI, "Associated in %lu ms (%s%s)", (unsigned long)wifiConnectStats.associationMs,
+         wifiConnectStats.fastPath ? "cached AP" : "scan", wifiConnectStats.leaseReused ? ", cached lease" : "");
+    saveCache();
+
+    // Capture the configured credentials; save() skips the write when unchanged
     strlcpy(config.ssid, WiFi.SSID().c_str(), sizeof(config.ssid));
     strlcpy(config.password, WiFi.psk().c_str(), sizeof(config.password));
     config.save();
+    return true;
 }
@@ -1,6 +1,26 @@
 #ifndef CALID_WIFI_SETUP_H
 #define CALID_WIFI_SETUP_H
 
-void runWifiSetup();
+#include <Arduino.h>
+
+#define WIFI_FAST_CONNECT_TIMEOUT_MS 3000 // Direct BSSID/channel attempt from the cache
+#define WIFI_CONNECT_TIMEOUT_MS 10000     // Full scan before falling back to the portal
+#define WIFI_GATEWAY_CHECK_MS 300         // ARP for the gateway before trusting a reused lease
+
+// ESP8266 RTC user memory block (4-byte units) holding the association cache
+#define WIFI_RTC_OFFSET 0
+#define WIFI_RTC_BLOCKS 8
+
+struct WifiConnectStats {
+    uint32_t associationMs = 0; // From beginWifiConnect() to WL_CONNECTED
+    bool fastPath = false;      // Connected using the cached BSSID/channel
+    bool leaseReused = false;   // Skipped DHCP using the cached lease, still before its T1
+};
+
+void beginWifiConnect(); // Starts association with the saved network without blocking
+// Waits for it, falling back to a full scan and then (if allowed) the WiFiManager portal
+bool runWifiSetup(bool allowPortal = true);
+
+extern WifiConnectStats wifiConnectStats;
 
 #endif